@@ -0,0 +1,172 @@
+/*
+ * This file is part of the improclib project.
+ * Copyright 2023 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Adaptive binarization by local statistics over square window (2r+1)x(2r+1) (cut by image borders). Image is
+ * divided into horizontal bands (one per thread); each thread keeps running sums (and sums of squares) of window
+ * rows for each column: they are updated by the row entering window and the row leaving it, so each row costs
+ * O(width) regardless of window size. Thresholds of row are calculated and pixels are packed into binary image
+ * in the same pass, so there's no full-frame intermediate data.
+ */
+
+#include <usefull_macros.h>
+#include <math.h>
+
+#include "improclib.h"
+#include "openmp.h"
+
+typedef unsigned __int128 u128;
+
+// default window radius
+#define ADAPT_RADIUS    (15)
+
+// thresholds `t` of row by local means `m` and variances `v`
+static void row_thresholds(il_adapt_t method, double k, double R, int w, const double *m, const double *v, double *t){
+    switch(method){
+        case IL_ADAPT_MEAN:
+            for(int x = 0; x < w; ++x) t[x] = m[x] + k;
+        break;
+        case IL_ADAPT_NIBLACK:
+            for(int x = 0; x < w; ++x) t[x] = m[x] + k * sqrt(v[x]);
+        break;
+        default: // IL_ADAPT_SAUVOLA
+            for(int x = 0; x < w; ++x) t[x] = m[x] * (1. + k * (sqrt(v[x]) / R - 1.));
+    }
+}
+
+// add (op is +=) or subtract (op is -=) image row `yy` to column sums
+#define ADDROW(type, stype, qtype, yy, op) do{ \
+    const type *in = IL_ROW(type, I, yy); \
+    for(int x = 0; x < w; ++x) cs[x] op (stype)in[x]; \
+    if(cq) for(int x = 0; x < w; ++x){ \
+        qtype p = (qtype)in[x]; \
+        cq[x] op p * p; \
+    }}while(0)
+
+/*
+ * binarize rows [ya, yb) of image with pixels of `type`: sums of values have `stype`, of squares - `qtype`;
+ * `var` is variance of `n` values with sum `s` and sum of squares `q`
+ */
+#define ADAPTBAND(type, stype, qtype, var) do{ \
+    stype *cs = MALLOC(stype, w), *ps = MALLOC(stype, w + 1); \
+    qtype *cq = NULL, *pq = NULL; \
+    if(needvar){ \
+        cq = MALLOC(qtype, w); \
+        pq = MALLOC(qtype, w + 1); \
+    } \
+    for(int yy = (ya > r) ? ya - r : 0; yy < ((ya + r < h) ? ya + r + 1 : h); ++yy) ADDROW(type, stype, qtype, yy, +=); \
+    for(int y = ya; y < yb; ++y){ \
+        if(y > ya){ \
+            if(y - r - 1 >= 0) ADDROW(type, stype, qtype, y - r - 1, -=); \
+            if(y + r < h) ADDROW(type, stype, qtype, y + r, +=); \
+        } \
+        int ny = ((y + r < h) ? y + r + 1 : h) - ((y > r) ? y - r : 0); \
+        ps[0] = 0; \
+        for(int x = 0; x < w; ++x) ps[x+1] = ps[x] + cs[x]; \
+        if(cq){ \
+            pq[0] = 0; \
+            for(int x = 0; x < w; ++x) pq[x+1] = pq[x] + cq[x]; \
+        } \
+        for(int x = 0; x < w; ++x){ \
+            int x0 = (x > r) ? x - r : 0, x1 = (x + r < w) ? x + r + 1 : w; \
+            uint64_t n = (uint64_t)(x1 - x0) * ny; \
+            stype s = ps[x1] - ps[x0]; \
+            m[x] = (double)s / n; \
+            if(cq){ \
+                qtype q = pq[x1] - pq[x0]; \
+                v[x] = var; \
+            } \
+        } \
+        row_thresholds(method, k, R, w, m, v, t); \
+        const type *in = IL_ROW(type, I, y); \
+        uint64_t *optr = IL_BINROW(O, y); \
+        for(int x = 0; x < w; x += 64){ \
+            int nb = (w - x < 64) ? w - x : 64; \
+            uint64_t o = 0; \
+            for(int i = 0; i < nb; ++i) o = (o << 1) | ((double)in[x+i] > t[x+i]); \
+            *optr++ = o << (64 - nb); \
+        } \
+    } \
+    FREE(cs); FREE(ps); FREE(cq); FREE(pq); \
+    }while(0)
+
+// exact variance of integer values and variance of floating point values
+#define IVAR    ((double)((u128)n * q - (u128)s * s) / ((double)n * n))
+#define DVAR    fmax(q / n - m[x] * m[x], 0.)
+
+/**
+ * @brief il_Image2binAdaptP - binarize image by local threshold (in one parallel pass)
+ * @param p - pool for output image (or NULL)
+ * @param I - image (without NaNs)
+ * @param method - how to calculate threshold by local mean and standard deviation (see il_adapt_t)
+ * @param r - radius of window (side is 2r+1; 0 - default 15)
+ * @param k - parameter of method
+ * @param R - dynamic range of standard deviation for IL_ADAPT_SAUVOLA (0 - default: 128 for U8, 32768 for U16,
+ *          half of data range for others)
+ * @return binary image (pixel is 1 if it's above local threshold) or NULL if error
+ */
+il_BinImage *il_Image2binAdaptP(il_ImagePool *p, const il_Image *I, il_adapt_t method, int r, double k, double R){
+    if(!I || !I->data || I->type >= IMTYPE_AMOUNT || method >= IL_ADAPT_AMOUNT) return NULL;
+    if(r < 1) r = ADAPT_RADIUS;
+    if(method == IL_ADAPT_SAUVOLA && R <= 0.){
+        if(I->type == IMTYPE_U8) R = 128.;
+        else if(I->type == IMTYPE_U16) R = 32768.;
+        else{ // cache is the only thing we could change here
+            il_Image_minmax((il_Image*)I);
+            R = (I->maxval - I->minval) / 2.;
+            if(R <= 0.) R = 1.;
+        }
+    }
+    int w = I->width, h = I->height, needvar = (method != IL_ADAPT_MEAN);
+    il_BinImage *O = il_BinImage_newP(p, w, h);
+    if(!O) return NULL;
+#pragma omp parallel
+{
+    int id = OMP_THREAD_NUM(), nt = OMP_NUM_THREADS();
+    int ya = (int)((size_t)h * id / nt), yb = (int)((size_t)h * (id + 1) / nt);
+    double *m = MALLOC(double, w), *v = MALLOC(double, w);
+    double *t = MALLOC(double, w);
+    if(ya < yb) switch(I->type){
+        case IMTYPE_U8:
+            ADAPTBAND(uint8_t, uint64_t, uint64_t, IVAR);
+        break;
+        case IMTYPE_U16:
+            ADAPTBAND(uint16_t, uint64_t, uint64_t, IVAR);
+        break;
+        case IMTYPE_U32:
+            ADAPTBAND(uint32_t, uint64_t, u128, IVAR);
+        break;
+        case IMTYPE_F:
+            ADAPTBAND(float, double, double, DVAR);
+        break;
+        default:
+            ADAPTBAND(double, double, double, DVAR);
+    }
+    FREE(m); FREE(v); FREE(t);
+}
+    return O;
+}
+#undef ADDROW
+#undef ADAPTBAND
+#undef IVAR
+#undef DVAR
+
+// the same as il_Image2binAdaptP but without pool
+il_BinImage *il_Image2binAdapt(const il_Image *I, il_adapt_t method, int r, double k, double R){
+    return il_Image2binAdaptP(NULL, I, method, r, k, R);
+}
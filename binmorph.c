@@ -32,239 +32,332 @@
 #define TEST(...)
 #endif
 
-// global arrays for erosion/dilation masks
-static uint8_t *ER = NULL, *DIL = NULL;
-
 /*
- * =================== AUXILIARY FUNCTIONS ===================>
+ * =================== BINARY IMAGES ===================>
  */
 
+// words per row of binary image with width `w` (rows are aligned to IL_ALIGN)
+int il_getbinstride(int w){
+    int nw = (w + 63) / 64, a = IL_ALIGN / sizeof(uint64_t);
+    return (nw + a - 1) / a * a;
+}
+
 /**
- * This function inits masks arrays for erosion and dilation
- * You may call it yourself or it will be called when one of
- * `erosion` or `dilation` functions will be ran first time
+ * @brief il_BinImage_new - allocate empty (zero-filled) packed binary image
+ * @param w, h - image size (pixels)
+ * @return image allocated here or NULL if error
  */
-static void morph_init(){
-    if(ER) return;
-    ER = MALLOC(uint8_t, 256);
-    DIL = MALLOC(uint8_t, 256);
-    OMP_FOR()
-    for(int i = 0; i < 256; i++){
-        ER[i]  = i & ((i << 1) | 1) & ((i >> 1) | (0x80)); // don't forget that << and >> set borders to zero
-        DIL[i] = i | (i << 1) | (i >> 1);
+il_BinImage *il_BinImage_new(int w, int h){
+    if(w < 1 || h < 1) return NULL;
+    il_BinImage *B = MALLOC(il_BinImage, 1);
+    B->width = w;
+    B->height = h;
+    B->stride = il_getbinstride(w);
+    B->data = il_alloc_rows(B->stride * sizeof(uint64_t), h);
+    return B;
+}
+
+// allocate empty binary image with the same size as `B`
+il_BinImage *il_BinImage_sim(const il_BinImage *B){
+    if(!B) return NULL;
+    return il_BinImage_new(B->width, B->height);
+}
+
+// free binary image (or return it into its pool)
+void il_BinImage_free(il_BinImage **B){
+    if(!B || !*B) return;
+    if((*B)->pool){
+        il_ImagePool_put((*B)->pool, (*B)->data);
+        *B = NULL;
+        return;
+    }
+    if((*B)->release) (*B)->release((*B)->data, (*B)->relctx);
+    else FREE((*B)->data);
+    FREE(*B);
+}
+
+// mask of valid pixels in last word of binary image row
+static inline uint64_t lastword_mask(int W){
+    int rest = W % 64;
+    return rest ? ~0ULL << (64 - rest) : ~0ULL;
+}
+
+// check that sizes of two binary images are equal
+static int samesize(const il_BinImage *b1, const il_BinImage *b2){
+    if(!b1 || !b2 || !b1->data || !b2->data) return FALSE;
+    if(b1->width != b2->width || b1->height != b2->height){
+        WARNX("Binary images have different sizes: %dx%d and %dx%d", b1->width, b1->height, b2->width, b2->height);
+        return FALSE;
     }
+    return TRUE;
 }
 
 /*
  * =================== MORPHOLOGICAL OPERATIONS ===================>
  */
 
-/**
- * Remove all non-4-connected pixels
- * @param image (i) - input image
- * @param W, H      - size of binarized image (in pixels)
- * @return allocated memory area with converted input image
+// row kernel: process row `cur` with its upper and lower neighbours (NULL for image borders)
+typedef void (*rowkernel)(const uint64_t *up, const uint64_t *cur, const uint64_t *down,
+                          uint64_t *out, int nw, uint64_t lastmask);
+
+/*
+ * Pixel x is bit (63 - x%64) of word x/64, so (w << 1) gives each pixel its right neighbour
+ * (with MSB of next word as carry) and (w >> 1) gives it its left neighbour (with LSB of previous word).
+ * Pixels outside of image are zeros; instead of branches for absent upper/lower rows they are
+ * replaced by `cur` with zero mask.
  */
-uint8_t *il_filter4(uint8_t *image, int W, int H){
-    //FNAME();
-    if(W < MINWIDTH || H < MINHEIGHT) return NULL;
-    uint8_t *ret = MALLOC(uint8_t, W*H);
-    int W0 = (W + 7) / 8; // width in bytes
-    int w = W0-1, h = H-1;
-    {
-    // top of image, y = 0
-    #define IM_UP
-    #include "fc_filter.inc"
-    #undef IM_UP
+#define ROW_PREPARE() \
+    uint64_t umask = up ? ~0ULL : 0ULL, dmask = down ? ~0ULL : 0ULL; \
+    if(!up) up = cur; \
+    if(!down) down = cur;
+
+// dilation by cross 3x3
+static void dilation_row(const uint64_t *up, const uint64_t *cur, const uint64_t *down,
+                         uint64_t *out, int nw, uint64_t lastmask){
+    ROW_PREPARE();
+    uint64_t prev = 0, w = cur[0];
+    for(int x = 0; x < nw; ++x){
+        uint64_t next = (x < nw - 1) ? cur[x+1] : 0;
+        out[x] = w | (w << 1) | (next >> 63) | (w >> 1) | (prev << 63) | (up[x] & umask) | (down[x] & dmask);
+        prev = w; w = next;
     }
-    {
-    // mid of image, y = 1..h-1
-    #include "fc_filter.inc"
+    out[nw-1] &= lastmask; // clear outern pixels
+}
+
+// erosion by cross 3x3 (all pixels on image borders are cleared)
+static void erosion_row(const uint64_t *up, const uint64_t *cur, const uint64_t *down,
+                        uint64_t *out, int nw, uint64_t lastmask){
+    ROW_PREPARE();
+    uint64_t prev = 0, w = cur[0];
+    for(int x = 0; x < nw; ++x){
+        uint64_t next = (x < nw - 1) ? cur[x+1] : 0;
+        out[x] = w & ((w << 1) | (next >> 63)) & ((w >> 1) | (prev << 63)) & up[x] & umask & down[x] & dmask;
+        prev = w; w = next;
     }
-    {
-    // image bottom, y = h
-    #define IM_DOWN
-    #include "fc_filter.inc"
-    #undef IM_DOWN
+    // pixels near right border: the last one is cleared by zero neighbour (padding bits are zero)
+    out[nw-1] &= lastmask;
+}
+
+// clear pixels without 4-connected neighbours
+static void filter4_row(const uint64_t *up, const uint64_t *cur, const uint64_t *down,
+                        uint64_t *out, int nw, uint64_t lastmask){
+    ROW_PREPARE();
+    uint64_t prev = 0, w = cur[0];
+    for(int x = 0; x < nw; ++x){
+        uint64_t next = (x < nw - 1) ? cur[x+1] : 0;
+        uint64_t p = (w << 1) | (next >> 63) | (w >> 1) | (prev << 63) | (up[x] & umask) | (down[x] & dmask);
+        out[x] = w & p;
+        prev = w; w = next;
+    }
+    out[nw-1] &= lastmask;
+}
+
+// clear pixels without 8-connected neighbours
+static void filter8_row(const uint64_t *up, const uint64_t *cur, const uint64_t *down,
+                        uint64_t *out, int nw, uint64_t lastmask){
+    ROW_PREPARE();
+    uint64_t prev = 0, w = cur[0];
+    uint64_t uprev = 0, u = up[0] & umask, dprev = 0, d = down[0] & dmask;
+    for(int x = 0; x < nw; ++x){
+        uint64_t next = 0, unext = 0, dnext = 0;
+        if(x < nw - 1){
+            next = cur[x+1];
+            unext = up[x+1] & umask;
+            dnext = down[x+1] & dmask;
+        }
+        uint64_t p = (w << 1) | (next >> 63) | (w >> 1) | (prev << 63)
+                   | u | (u << 1) | (unext >> 63) | (u >> 1) | (uprev << 63)
+                   | d | (d << 1) | (dnext >> 63) | (d >> 1) | (dprev << 63);
+        out[x] = w & p;
+        prev = w; w = next;
+        uprev = u; u = unext;
+        dprev = d; d = dnext;
+    }
+    out[nw-1] &= lastmask;
+}
+#undef ROW_PREPARE
+
+// run row kernel `fn` over rows [y0, y1) of `in` storing result in `out`
+static void morph_rows(const il_BinImage *in, il_BinImage *out, rowkernel fn, int y0, int y1){
+    int h = in->height - 1, nw = (in->width + 63) / 64;
+    uint64_t lastmask = lastword_mask(in->width);
+    OMP_FOR(schedule(static))
+    for(int y = y0; y < y1; ++y){
+        const uint64_t *up = y ? IL_BINROW(in, y-1) : NULL;
+        const uint64_t *down = (y < h) ? IL_BINROW(in, y+1) : NULL;
+        fn(up, IL_BINROW(in, y), down, IL_BINROW(out, y), nw, lastmask);
     }
+}
+
+// make operation `fn` with output in image from pool `p`
+static il_BinImage *morph(il_ImagePool *p, const il_BinImage *B, rowkernel fn){
+    if(!B || !B->data) return NULL;
+    if(B->width < MINWIDTH || B->height < MINHEIGHT) return NULL;
+    il_BinImage *ret = il_BinImage_newP(p, B->width, B->height);
+    morph_rows(B, ret, fn, 0, B->height);
     return ret;
 }
 
+// make operation `fn` N times using ping-pong buffers from pool `p`
+static il_BinImage *morphN(il_ImagePool *p, const il_BinImage *B, int N, rowkernel fn){
+    if(N < 1) return NULL;
+    il_BinImage *out = morph(p, B, fn);
+    if(!out || N == 1) return out;
+    il_BinImage *in = il_BinImage_newP(p, B->width, B->height);
+    for(int i = 1; i < N; ++i){
+        register il_BinImage *tmp = in;
+        in = out; out = tmp;
+        morph_rows(in, out, fn, 0, B->height);
+    }
+    il_BinImage_free(&in);
+    return out;
+}
+
+// make operation `fn` band by band releasing processed parts of mmap'ed images
+static int morphS(const il_BinImage *in, il_BinImage *out, int bandh, rowkernel fn){
+    if(!samesize(in, out)) return FALSE;
+    if(in->width < MINWIDTH || in->height < MINHEIGHT) return FALSE;
+    if(bandh < 1) bandh = IL_BANDHEIGHT;
+    int H = in->height;
+    for(int y0 = 0; y0 < H; y0 += bandh){
+        int y1 = (y0 + bandh < H) ? y0 + bandh : H;
+        il_BinImage_advise(in, y1, bandh + 1, IL_ADV_WILLNEED);
+        morph_rows(in, out, fn, y0, y1);
+        il_BinImage_advise(in, y0 - 1, y1 - y0, IL_ADV_DONTNEED); // row y1-1 is needed for next band
+        il_BinImage_advise(out, y0, y1 - y0, IL_ADV_DONTNEED);
+    }
+    return TRUE;
+}
+
 /**
- * Remove all non-8-connected pixels (single points)
- * @param image (i) - input image
- * @param W, H      - size of binarized image (in pixels)
- * @return allocated memory area with converted input image
+ * @brief il_dilationS - dilation of (mmap'ed) binary image band by band with bounded working set
+ * @param in - input image
+ * @param out (o) - output image of the same size (e.g. il_BinImage_mmap with IL_MMAP_CREATE)
+ * @param bandh - band height (rows) or 0 for IL_BANDHEIGHT
+ * @return FALSE if error
+ */
+int il_dilationS(const il_BinImage *in, il_BinImage *out, int bandh){
+    return morphS(in, out, bandh, dilation_row);
+}
+// the same for erosion
+int il_erosionS(const il_BinImage *in, il_BinImage *out, int bandh){
+    return morphS(in, out, bandh, erosion_row);
+}
+
+/**
+ * Remove all non-4-connected pixels
+ * @param B (i) - input image
+ * @return allocated here image
  */
-uint8_t *il_filter8(uint8_t *image, int W, int H){
+il_BinImage *il_filter4(const il_BinImage *B){
     //FNAME();
-    if(W < MINWIDTH || H < MINHEIGHT) return NULL;
-    uint8_t *ret = MALLOC(uint8_t, W*H);
-    int W0 = (W + 7) / 8; // width in bytes
-    int w = W0-1, h = H-1;
-    {
-    #define IM_UP
-    #include "ec_filter.inc"
-    #undef IM_UP
-    }
-    {
-    #include "ec_filter.inc"
-    }
-    {
-    #define IM_DOWN
-    #include "ec_filter.inc"
-    #undef IM_DOWN
-    }
-    return ret;
+    return morph(NULL, B, filter4_row);
 }
 
 /**
- * Make morphological operation of dilation
- * @param image (i) - input image
- * @param W, H      - size of image (pixels)
- * @return allocated memory area with dilation of input image
+ * Remove all non-8-connected pixels (single points)
+ * @param B (i) - input image
+ * @return allocated here image
  */
-uint8_t *il_dilation(const uint8_t *image, int W, int H){
+il_BinImage *il_filter8(const il_BinImage *B){
     //FNAME();
-    if(W < MINWIDTH || H < MINHEIGHT) return NULL;
-    int W0 = (W + 7) / 8; // width in bytes
-    int w = W0-1, h = H-1, rest = 7 - (W - w*8);
-    uint8_t lastmask = ~(1<<rest);
-    if(!DIL) morph_init();
-    uint8_t *ret = MALLOC(uint8_t, W0*H);
-    {
-    // top of image, y = 0
-    #define IM_UP
-    #include "dilation.inc"
-    #undef IM_UP
-    }
-    {
-    // mid of image, y = 1..h-1
-    #include "dilation.inc"
-    }
-    {
-    // image bottom, y = h
-    #define IM_DOWN
-    #include "dilation.inc"
-    #undef IM_DOWN
-    }
-    return ret;
+    return morph(NULL, B, filter8_row);
 }
 
-static void mkerosion(const uint8_t *in, uint8_t *out, int W, int H){
-    if(!ER) morph_init();
-    int W0 = (W + 7) / 8; // width in bytes
-    int w = W0-1, h = H-1, rest = 8 - (W - w*8);
-    uint8_t lastmask = ~(1<<rest);
-    // clear first and last rows:
-    bzero(out, W0);
-    bzero(out + W0*h, W0);
-    //DBG("rest=%d, mask:0x%x", rest, lastmask);
-    OMP_FOR()
-    for(int y = 1; y < h; y++){ // reset first & last rows of image
-        const uint8_t *iptr = &in[W0*y];
-        uint8_t *optr = &out[W0*y];
-        register uint8_t p;
-        // x == 0, reset left bit
-        p = ER[*iptr] & iptr[-W0] & iptr[W0];
-        if(!(*(++iptr) & 0x80)) p &= 0xfe;
-        *optr++ = p & 0x7f;
-        for(int x = 1; x < w; x++, iptr++, optr++){
-            p = iptr[-W0];
-            p = ER[*iptr] & iptr[-W0] & iptr[W0];
-            if(!(iptr[-1] & 1)) p &= 0x7f;
-            if(!(iptr[1] & 0x80)) p &= 0xfe;
-            *optr = p;
-        }
-        // x == w, reset right bit
-        p = ER[*iptr] & iptr[-W0] & iptr[W0];
-        if(!(iptr[-1] & 1)) p &= 0x7f;
-        *optr = p & lastmask; // reset right bit
-    }
+/**
+ * Make morphological operation of dilation
+ * @param B (i) - input image
+ * @return allocated here dilation of input image
+ */
+il_BinImage *il_dilation(const il_BinImage *B){
+    return morph(NULL, B, dilation_row);
+}
+// the same as il_dilation but with image from pool `p`
+il_BinImage *il_dilationP(il_ImagePool *p, const il_BinImage *B){
+    return morph(p, B, dilation_row);
 }
 
 /**
  * Make morphological operation of erosion by cross 3x3 pixels
- * @param image (i) - input image
- * @param W, H      - size of image (in pixels)
- * @return allocated memory area with erosion of input image
+ * @param B (i) - input image
+ * @return allocated here erosion of input image
  */
-uint8_t *il_erosion(const uint8_t *image, int W, int H){
-    if(W < MINWIDTH || H < MINHEIGHT) return NULL;
-    int W0 = (W + 7) / 8; // width in bytes
-    uint8_t *ret = MALLOC(uint8_t, W0*H);
-    mkerosion(image, ret, W, H);
-    return ret;
+il_BinImage *il_erosion(const il_BinImage *B){
+    return morph(NULL, B, erosion_row);
+}
+// the same as il_erosion but with image from pool `p`
+il_BinImage *il_erosionP(il_ImagePool *p, const il_BinImage *B){
+    return morph(p, B, erosion_row);
 }
+
 // Make erosion N times
-uint8_t *il_erosionN(const uint8_t *image, int W, int H, int N){
-    if(W < MINWIDTH || H < MINHEIGHT || N < 1) return NULL;
-    int W0 = (W + 7) / 8, sz = W0*H;
-    uint8_t *in = MALLOC(uint8_t, sz), *out = MALLOC(uint8_t, sz);
-    memcpy(out, image, sz);
-    for(int i = 0; i < N; ++i){
-        register uint8_t *tmp = in;
-        in = out; out = tmp;
-        mkerosion(in, out, W, H);
-    }
-    FREE(in);
-    return out;
+il_BinImage *il_erosionN(const il_BinImage *B, int N){
+    return morphN(NULL, B, N, erosion_row);
+}
+il_BinImage *il_erosionNP(il_ImagePool *p, const il_BinImage *B, int N){
+    return morphN(p, B, N, erosion_row);
 }
 // Make dilation N times
-uint8_t *il_dilationN(const uint8_t *image, int W, int H, int N){
-    if(W < MINWIDTH || H < MINHEIGHT || N < 1) return NULL;
-    uint8_t *cur = (uint8_t*)image, *next = NULL;
-    for(int i = 0; i < N; ++i){
-        next = il_dilation(cur, W, H);
-        if(cur != image) FREE(cur);
-        cur = next;
-    }
-    return next;
+il_BinImage *il_dilationN(const il_BinImage *B, int N){
+    return morphN(NULL, B, N, dilation_row);
+}
+il_BinImage *il_dilationNP(il_ImagePool *p, const il_BinImage *B, int N){
+    return morphN(p, B, N, dilation_row);
 }
 
 // Ntimes opening
-uint8_t *il_openingN(uint8_t *image, int W, int H, int N){
+il_BinImage *il_openingN(const il_BinImage *B, int N){
+    return il_openingNP(NULL, B, N);
+}
+il_BinImage *il_openingNP(il_ImagePool *p, const il_BinImage *B, int N){
     //FNAME();
-    if(W < MINWIDTH || H < MINHEIGHT || N < 1) return NULL;
-    uint8_t *er = il_erosionN(image, W, H, N);
-    uint8_t *op = il_dilationN(er, W, H, N);
-    FREE(er);
+    il_BinImage *er = il_erosionNP(p, B, N);
+    if(!er) return NULL;
+    il_BinImage *op = il_dilationNP(p, er, N);
+    il_BinImage_free(&er);
     return op;
 }
 
 // Ntimes closing
-uint8_t *il_closingN(uint8_t *image, int W, int H, int N){
+il_BinImage *il_closingN(const il_BinImage *B, int N){
+    return il_closingNP(NULL, B, N);
+}
+il_BinImage *il_closingNP(il_ImagePool *p, const il_BinImage *B, int N){
     //FNAME();
-    if(W < MINWIDTH || H < MINHEIGHT || N < 1) return NULL;
-    uint8_t *di = il_dilationN(image, W, H, N);
-    uint8_t *cl = il_erosionN(di, W, H, N);
-    FREE(di);
+    il_BinImage *di = il_dilationNP(p, B, N);
+    if(!di) return NULL;
+    il_BinImage *cl = il_erosionNP(p, di, N);
+    il_BinImage_free(&di);
     return cl;
 }
 
 // top hat operation: image - opening(image)
-uint8_t *il_topHat(uint8_t *image, int W, int H, int N){
+il_BinImage *il_topHat(const il_BinImage *B, int N){
     //FNAME();
-    if(W < MINWIDTH || H < MINHEIGHT || N < 1) return NULL;
-    uint8_t *op = il_openingN(image, W, H, N);
-    int W0 = (W + 7) / 8; // width in bytes
-    int wh = W0 * H;
-    OMP_FOR()
-    for(int i = 0; i < wh; ++i)
-        op[i] = image[i] & (~op[i]);
+    il_BinImage *op = il_openingN(B, N);
+    if(!op) return NULL;
+    int H = B->height, nw = (B->width + 63) / 64;
+    OMP_FOR(schedule(static))
+    for(int y = 0; y < H; ++y){
+        const uint64_t *i = IL_BINROW(B, y);
+        uint64_t *o = IL_BINROW(op, y);
+        for(int x = 0; x < nw; ++x) o[x] = i[x] & ~o[x];
+    }
     return op;
 }
 
 // bottom hat operation: closing(image) - image
-uint8_t *il_botHat(uint8_t *image, int W, int H, int N){
+il_BinImage *il_botHat(const il_BinImage *B, int N){
     //FNAME();
-    if(W < MINWIDTH || H < MINHEIGHT || N < 1) return NULL;
-    uint8_t *op = il_closingN(image, W, H, N);
-    int W0 = (W + 7) / 8; // width in bytes
-    int wh = W0 * H;
-    OMP_FOR()
-    for(int i = 0; i < wh; ++i)
-        op[i] &= ~image[i];
+    il_BinImage *op = il_closingN(B, N);
+    if(!op) return NULL;
+    int H = B->height, nw = (B->width + 63) / 64;
+    OMP_FOR(schedule(static))
+    for(int y = 0; y < H; ++y){
+        const uint64_t *i = IL_BINROW(B, y);
+        uint64_t *o = IL_BINROW(op, y);
+        for(int x = 0; x < nw; ++x) o[x] &= ~i[x];
+    }
     return op;
 }
 
@@ -277,38 +370,38 @@ uint8_t *il_botHat(uint8_t *image, int W, int H, int N){
  */
 /**
  * Logical AND of two images
- * @param im1, im2 (i) - two images
- * @param W, H         - their size (of course, equal for both images)
- * @return allocated memory area with   image = (im1 AND im2)
+ * @param im1, im2 (i) - two images (of course, with equal size)
+ * @return allocated here image = (im1 AND im2)
  */
-uint8_t *il_imand(uint8_t *im1, uint8_t *im2, int W, int H){
-    uint8_t *ret = MALLOC(uint8_t, W*H);
-    int y;
-    OMP_FOR()
-    for(y = 0; y < H; y++){
-        int x, S = y*W;
-        uint8_t *rptr = &ret[S], *p1 = &im1[S], *p2 = &im2[S];
-        for(x = 0; x < W; x++)
-            *rptr++ = *p1++ & *p2++;
+il_BinImage *il_imand(const il_BinImage *im1, const il_BinImage *im2){
+    if(!samesize(im1, im2)) return NULL;
+    il_BinImage *ret = il_BinImage_sim(im1);
+    int H = im1->height, nw = (im1->width + 63) / 64;
+    OMP_FOR(schedule(static))
+    for(int y = 0; y < H; y++){
+        const uint64_t *p1 = IL_BINROW(im1, y), *p2 = IL_BINROW(im2, y);
+        uint64_t *rptr = IL_BINROW(ret, y);
+        for(int x = 0; x < nw; x++)
+            rptr[x] = p1[x] & p2[x];
     }
     return ret;
 }
 
 /**
  * Substitute image 2 from image 1: reset to zero all bits of image 1 which set to 1 on image 2
- * @param im1, im2 (i) - two images
- * @param W, H         - their size (of course, equal for both images)
- * @return allocated memory area with    image = (im1 AND (!im2))
+ * @param im1, im2 (i) - two images (of course, with equal size)
+ * @return allocated here image = (im1 AND (!im2))
  */
-uint8_t *il_substim(uint8_t *im1, uint8_t *im2, int W, int H){
-    uint8_t *ret = MALLOC(uint8_t, W*H);
-    int y;
-    OMP_FOR()
-    for(y = 0; y < H; y++){
-        int x, S = y*W;
-        uint8_t *rptr = &ret[S], *p1 = &im1[S], *p2 = &im2[S];
-        for(x = 0; x < W; x++)
-            *rptr++ = *p1++ & (~*p2++);
+il_BinImage *il_substim(const il_BinImage *im1, const il_BinImage *im2){
+    if(!samesize(im1, im2)) return NULL;
+    il_BinImage *ret = il_BinImage_sim(im1);
+    int H = im1->height, nw = (im1->width + 63) / 64;
+    OMP_FOR(schedule(static))
+    for(int y = 0; y < H; y++){
+        const uint64_t *p1 = IL_BINROW(im1, y), *p2 = IL_BINROW(im2, y);
+        uint64_t *rptr = IL_BINROW(ret, y);
+        for(int x = 0; x < nw; x++)
+            rptr[x] = p1[x] & (~p2[x]);
     }
     return ret;
 }
@@ -341,25 +434,29 @@ static inline void remark(size_t newval, size_t oldval, size_t *assoc){
  * label 4-connected components on image
  * (slow algorythm, but easy to parallel)
  *
- * @param I (i)    - image ("packed")
- * @param W,H      - size of the image (W - width in pixels)
+ * @param B (i)    - packed binary image
  * @param CC (o)   - connected components boxes (numeration starts from 1!!!), so first box is CC->box[1], amount of boxes is CC->Nobj-1 !!!
  * @return an array of labeled components
  */
-size_t *il_CClabel4(uint8_t *Img, int W, int H, il_ConnComps **CC){
+size_t *il_CClabel4(const il_BinImage *B, il_ConnComps **CC){
+    return il_CClabel4P(NULL, B, CC);
+}
+// the same as il_CClabel4 but with labels & temporary buffers from pool `p`
+size_t *il_CClabel4P(il_ImagePool *p, const il_BinImage *B, il_ConnComps **CC){
     size_t *assoc;
-    if(W < MINWIDTH || H < MINHEIGHT) return NULL;
-    uint8_t *f = il_filter4(Img, W, H); // remove all non 4-connected pixels
+    il_BinImage *f = morph(p, B, filter4_row); // remove all non 4-connected pixels
+    if(!f) return NULL;
+    int W = B->width, H = B->height;
     //DBG("convert to size_t");
-    size_t *labels = il_bin2sizet(f, W, H);
-    FREE(f);
+    size_t *labels = il_bin2sizetP(p, f);
+    il_BinImage_free(&f);
     //DBG("Calculate");
-    size_t Nmax = W*H/4; // max number of 4-connected labels
-    assoc = MALLOC(size_t, Nmax); // allocate memory for "remark" array
+    size_t Nmax = (size_t)W*H/4 + 1; // max number of 4-connected labels
+    assoc = il_ImagePool_getbuf(p, Nmax * sizeof(size_t)); // allocate memory for "remark" array
     size_t last_assoc_idx = 1; // last index filled in assoc array
     for(int y = 0; y < H; ++y){
         bool found = false;
-        size_t *ptr = &labels[y*W];
+        size_t *ptr = &labels[(size_t)y*W];
         size_t curmark = 0; // mark of pixel to the left
         for(int x = 0; x < W; ++x, ++ptr){
             if(!*ptr){found = false; continue;} // empty pixel
@@ -415,7 +512,7 @@ size_t *il_CClabel4(uint8_t *Img, int W, int H, il_ConnComps **CC){
         printf("%zd\t%zd\t%zd\n",i,assoc[i],indexes[i]);
     #endif
     il_Box *boxes = MALLOC(il_Box, cidx);
-    OMP_FOR()
+    OMP_FOR(schedule(static))
     for(size_t i = 1; i < cidx; ++i){ // init borders
         boxes[i].xmin = W;
         boxes[i].ymin = H;
@@ -429,7 +526,7 @@ size_t *il_CClabel4(uint8_t *Img, int W, int H, il_ConnComps **CC){
         }
         #pragma omp for nowait
     for(int y = 0; y < H; ++y){
-        size_t *lptr = &labels[y*W];
+        size_t *lptr = &labels[(size_t)y*W];
         for(int x = 0; x < W; ++x, ++lptr){
             if(!*lptr) continue;
             register size_t mark = indexes[*lptr];
@@ -453,7 +550,7 @@ size_t *il_CClabel4(uint8_t *Img, int W, int H, il_ConnComps **CC){
     }
     FREE(l_boxes);
     }
-    FREE(assoc);
+    il_ImagePool_put(p, assoc);
     FREE(indexes);
 #ifdef TESTMSGS
     for(size_t i = 1; i < cidx; ++i){
@@ -0,0 +1,450 @@
+/*
+ * This file is part of the improclib project.
+ * Copyright 2023 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Mesh background map (like in SExtractor): image is divided into cells, in each cell (in parallel) values are
+ * clipped around median, background is estimated as mode 2.5*median - 1.5*mean (or median in crowded cells) and RMS
+ * as clipped sigma. Cells without enough pixels get mean of neighbours, then both grids are median-filtered.
+ * Map values between cell centers are interpolated by natural bicubic splines: second derivatives along Y are
+ * calculated once for each column of cells, so any image row is obtained by O(nx) spline setup + evaluation of
+ * one cubic per pixel. So subtraction and thresholding are made row by row without full-frame map.
+ */
+
+#include <usefull_macros.h>
+#include <math.h>
+#include <string.h>
+
+#include "improclib.h"
+#include "openmp.h"
+
+#define BKG_MESHSIZE    (64)    // default cell side
+#define BKG_FILTERSIZE  (3)     // default median filter size (cells)
+#define BKG_CLIPK       (3.)    // clipping threshold (sigmas)
+#define BKG_CLIPITER    (10)    // max amount of clipping iterations
+#define BKG_MINGOOD     (0.5)   // min part of non-NaN pixels in cell
+#define BKG_CROWDED     (0.3)   // (mean - median)/sigma for crowded cells
+
+// clipped background and RMS of `n` values `a` (array is reordered and changed)
+static void cell_stat(double *a, size_t n, float *bkg, float *rms){
+    il_ClipStats st;
+    il_sigmaclip(a, n, BKG_CLIPK, BKG_CLIPITER, &st);
+    double sigma = st.std, med = st.median, mean = st.mean;
+    *bkg = (float)((sigma > 0. && fabs(mean - med) / sigma < BKG_CROWDED) ? 2.5 * med - 1.5 * mean : med);
+    *rms = (float)sigma;
+}
+
+// non-NaN values of cell [x0, x1) x [y0, y1) of image into `a`
+#define CELLVALS(type) \
+    for(int y = y0; y < y1; ++y){ \
+        const type *row = IL_ROW(type, I, y); \
+        for(int x = x0; x < x1; ++x){ \
+            double v = (double)row[x]; \
+            if(v == v) a[n++] = v; \
+        } \
+    }
+
+static size_t cell_values(const il_Image *I, int x0, int x1, int y0, int y1, double *a){
+    size_t n = 0;
+    switch(I->type){
+        case IMTYPE_U8:
+            CELLVALS(uint8_t);
+        break;
+        case IMTYPE_U16:
+            CELLVALS(uint16_t);
+        break;
+        case IMTYPE_U32:
+            CELLVALS(uint32_t);
+        break;
+        case IMTYPE_F:
+            CELLVALS(float);
+        break;
+        default:
+            CELLVALS(double);
+    }
+    return n;
+}
+#undef CELLVALS
+
+// replace NaN cells by mean of their non-NaN neighbours (repeatedly); return FALSE if all cells are NaN
+static int fill_bad(float *g, int nx, int ny){
+    int nbad = 0, N = nx * ny;
+    for(int i = 0; i < N; ++i) if(isnan(g[i])) ++nbad;
+    if(nbad == N) return FALSE;
+    float *t = MALLOC(float, N);
+    while(nbad){
+        memcpy(t, g, N * sizeof(float));
+        for(int j = 0; j < ny; ++j) for(int i = 0; i < nx; ++i){
+            if(!isnan(t[j*nx + i])) continue;
+            double s = 0.; int n = 0;
+            for(int jj = j - 1; jj <= j + 1; ++jj){
+                if(jj < 0 || jj >= ny) continue;
+                for(int ii = i - 1; ii <= i + 1; ++ii){
+                    if(ii < 0 || ii >= nx || isnan(t[jj*nx + ii])) continue;
+                    s += t[jj*nx + ii]; ++n;
+                }
+            }
+            if(n){
+                g[j*nx + i] = (float)(s / n);
+                --nbad;
+            }
+        }
+    }
+    FREE(t);
+    return TRUE;
+}
+
+// median filter of grid by window f x f (edge cells are repeated: cut window would shift gradients at edges)
+static void median_filter(float *g, int nx, int ny, int f){
+    int N = nx * ny, r = f / 2;
+    float *t = MALLOC(float, N);
+    double *w = MALLOC(double, f * f);
+    memcpy(t, g, N * sizeof(float));
+    for(int j = 0; j < ny; ++j) for(int i = 0; i < nx; ++i){
+        int n = 0;
+        for(int jj = j - r; jj <= j + r; ++jj){
+            int y = (jj < 0) ? 0 : (jj >= ny) ? ny - 1 : jj;
+            for(int ii = i - r; ii <= i + r; ++ii){
+                int x = (ii < 0) ? 0 : (ii >= nx) ? nx - 1 : ii;
+                w[n++] = t[y*nx + x];
+            }
+        }
+        g[j*nx + i] = (float)il_qselect(w, n, n / 2);
+    }
+    FREE(w);
+    FREE(t);
+}
+
+// center of cell `i` (pixel coordinates) for cells of size `mesh` over `len` pixels
+static inline double cell_center(int i, int mesh, int len){
+    int c0 = i * mesh, c1 = c0 + mesh;
+    if(c1 > len) c1 = len;
+    return 0.5 * (c0 + c1 - 1);
+}
+
+/**
+ * @brief spline_d2 - second derivatives of natural cubic spline
+ * @param x - knots (ascending)
+ * @param y - values in knots (with stride `ys`)
+ * @param n - amount of knots
+ * @param d2 (o) - second derivatives (with stride `ys`)
+ * @param u - workspace of `n` values
+ */
+static void spline_d2(const double *x, const float *y, int ys, int n, float *d2, double *u){
+    double *d = u + n; // second derivatives in double (the second half of workspace)
+    d[0] = u[0] = 0.;
+    for(int i = 1; i < n - 1; ++i){
+        double sig = (x[i] - x[i-1]) / (x[i+1] - x[i-1]);
+        double p = sig * d[i-1] + 2.;
+        d[i] = (sig - 1.) / p;
+        u[i] = (y[(i+1)*ys] - y[i*ys]) / (x[i+1] - x[i]) - (y[i*ys] - y[(i-1)*ys]) / (x[i] - x[i-1]);
+        u[i] = (6. * u[i] / (x[i+1] - x[i-1]) - sig * u[i-1]) / p;
+    }
+    d[n-1] = 0.;
+    for(int k = n - 2; k >= 0; --k) d[k] = d[k] * d[k+1] + u[k];
+    for(int k = 0; k < n; ++k) d2[k*ys] = (float)d[k];
+}
+
+// interval of spline with knots `x` containing point `t` (or the nearest one)
+static inline int spline_interval(const double *x, int n, double t){
+    int k = 0;
+    while(k < n - 2 && t > x[k+1]) ++k;
+    return k;
+}
+
+// value of spline in point `t` of interval `k`
+static inline double spline_val(const double *x, const float *y, const float *d2, int ys, int k, double t){
+    double h = x[k+1] - x[k], a = (x[k+1] - t) / h, b = 1. - a;
+    return a * y[k*ys] + b * y[(k+1)*ys] + ((a*a*a - a) * d2[k*ys] + (b*b*b - b) * d2[(k+1)*ys]) * h * h / 6.;
+}
+
+// evaluate spline (knots `x`, values `y`, second derivatives `d2`) in pixels 0..w-1
+static void spline_row(const double *x, const float *y, const float *d2, int n, int w, float *out){
+    if(n == 1){
+        for(int i = 0; i < w; ++i) out[i] = y[0];
+        return;
+    }
+    int i = 0;
+    for(int k = 0; k < n - 1; ++k){
+        int iend = (k == n - 2) ? w : (int)floor(x[k+1]) + 1; // the last interval is extrapolated to the end
+        if(iend > w) iend = w;
+        double h = x[k+1] - x[k], x1 = x[k+1], y0 = y[k], y1 = y[k+1];
+        double c0 = d2[k] * h * h / 6., c1 = d2[k+1] * h * h / 6., ih = 1. / h;
+        for(; i < iend; ++i){
+            double a = (x1 - i) * ih, b = 1. - a;
+            out[i] = (float)(a * y0 + b * y1 + (a*a*a - a) * c0 + (b*b*b - b) * c1);
+        }
+    }
+}
+
+// workspace for bkg_row: knots and values by X (nx) and Y (ny)
+typedef struct{
+    double *cx;
+    double *cy;
+    float *v;
+    float *d2;
+    double *u;
+} rowws;
+
+static void rowws_init(rowws *w, const il_BkgMap *B){
+    int n = (B->nx > B->ny) ? B->nx : B->ny;
+    w->cx = MALLOC(double, B->nx);
+    w->cy = MALLOC(double, B->ny);
+    w->v = MALLOC(float, B->nx);
+    w->d2 = MALLOC(float, B->nx);
+    w->u = MALLOC(double, 2 * n);
+    for(int i = 0; i < B->nx; ++i) w->cx[i] = cell_center(i, B->meshsize, B->width);
+    for(int j = 0; j < B->ny; ++j) w->cy[j] = cell_center(j, B->meshsize, B->height);
+}
+
+static void rowws_free(rowws *w){
+    FREE(w->cx); FREE(w->cy); FREE(w->v); FREE(w->d2); FREE(w->u);
+}
+
+// interpolate row `y` of grid `g` (with second derivatives `d2g` along Y) into `out`
+static void bkg_row(const il_BkgMap *B, const float *g, const float *d2g, int y, rowws *w, float *out){
+    int nx = B->nx, ny = B->ny;
+    if(ny == 1) memcpy(w->v, g, nx * sizeof(float));
+    else{
+        int k = spline_interval(w->cy, ny, y);
+        for(int i = 0; i < nx; ++i) w->v[i] = (float)spline_val(w->cy, g + i, d2g + i, nx, k, y);
+    }
+    spline_d2(w->cx, w->v, 1, nx, w->d2, w->u);
+    spline_row(w->cx, w->v, w->d2, nx, B->width, out);
+}
+
+/**
+ * @brief il_Image_bkgmap - calculate background map of image
+ * @param I - image
+ * @param meshsize - cell side (0 - default 64)
+ * @param filtersize - size of median filter across cells (odd; 0 - default 3, 1 - no filtering)
+ * @return map allocated here (free it by il_BkgMap_free()) or NULL if error
+ */
+il_BkgMap *il_Image_bkgmap(const il_Image *I, int meshsize, int filtersize){
+    if(!I || !I->data || I->type >= IMTYPE_AMOUNT) return NULL;
+    if(meshsize < 1) meshsize = BKG_MESHSIZE;
+    if(filtersize < 1) filtersize = BKG_FILTERSIZE;
+    filtersize |= 1;
+    int w = I->width, h = I->height;
+    if(meshsize > w && meshsize > h) meshsize = (w > h) ? w : h;
+    int nx = (w + meshsize - 1) / meshsize, ny = (h + meshsize - 1) / meshsize, N = nx * ny;
+    il_BkgMap *B = MALLOC(il_BkgMap, 1);
+    B->width = w; B->height = h;
+    B->meshsize = meshsize;
+    B->nx = nx; B->ny = ny;
+    B->bkg = MALLOC(float, N);
+    B->rms = MALLOC(float, N);
+    B->d2bkg = MALLOC(float, N);
+    B->d2rms = MALLOC(float, N);
+#pragma omp parallel
+{
+    double *a = MALLOC(double, (size_t)meshsize * meshsize);
+    #pragma omp for schedule(dynamic)
+    for(int c = 0; c < N; ++c){
+        int x0 = (c % nx) * meshsize, y0 = (c / nx) * meshsize;
+        int x1 = (x0 + meshsize < w) ? x0 + meshsize : w, y1 = (y0 + meshsize < h) ? y0 + meshsize : h;
+        size_t n = cell_values(I, x0, x1, y0, y1, a);
+        if(n < 1 || n < BKG_MINGOOD * (x1 - x0) * (y1 - y0)) B->bkg[c] = B->rms[c] = NAN;
+        else cell_stat(a, n, &B->bkg[c], &B->rms[c]);
+    }
+    FREE(a);
+}
+    if(!fill_bad(B->bkg, nx, ny) || !fill_bad(B->rms, nx, ny)){
+        WARNX("il_Image_bkgmap(): no good cells");
+        il_BkgMap_free(&B);
+        return NULL;
+    }
+    if(filtersize > 1){
+        median_filter(B->bkg, nx, ny, filtersize);
+        median_filter(B->rms, nx, ny, filtersize);
+    }
+    // splines along Y for each column of cells
+    rowws ws;
+    rowws_init(&ws, B);
+    for(int i = 0; i < nx; ++i){
+        spline_d2(ws.cy, B->bkg + i, nx, ny, B->d2bkg + i, ws.u);
+        spline_d2(ws.cy, B->rms + i, nx, ny, B->d2rms + i, ws.u);
+    }
+    rowws_free(&ws);
+    return B;
+}
+
+void il_BkgMap_free(il_BkgMap **B){
+    if(!B || !*B) return;
+    FREE((*B)->bkg);
+    FREE((*B)->rms);
+    FREE((*B)->d2bkg);
+    FREE((*B)->d2rms);
+    FREE(*B);
+}
+
+/**
+ * @brief il_BkgMap_row - interpolated background and RMS of one image row
+ * @param B - map
+ * @param y - row number
+ * @param bkg (o) - background (B->width values) or NULL
+ * @param rms (o) - RMS or NULL
+ * @return FALSE if error
+ */
+int il_BkgMap_row(const il_BkgMap *B, int y, float *bkg, float *rms){
+    if(!B || y < 0 || y >= B->height) return FALSE;
+    rowws ws;
+    rowws_init(&ws, B);
+    if(bkg) bkg_row(B, B->bkg, B->d2bkg, y, &ws, bkg);
+    if(rms) bkg_row(B, B->rms, B->d2rms, y, &ws, rms);
+    rowws_free(&ws);
+    return TRUE;
+}
+
+/**
+ * @brief il_BkgMap_image - full-frame map
+ * @param B - map
+ * @param rms - FALSE for background, TRUE for RMS
+ * @return float image allocated here or NULL if error
+ */
+il_Image *il_BkgMap_image(const il_BkgMap *B, int rms){
+    if(!B) return NULL;
+    il_Image *O = il_Image_new(B->width, B->height, IMTYPE_F);
+    if(!O) return NULL;
+    const float *g = rms ? B->rms : B->bkg, *d2 = rms ? B->d2rms : B->d2bkg;
+#pragma omp parallel
+{
+    rowws ws;
+    rowws_init(&ws, B);
+    #pragma omp for schedule(static)
+    for(int y = 0; y < B->height; ++y) bkg_row(B, g, d2, y, &ws, IL_ROW(float, O, y));
+    rowws_free(&ws);
+}
+    return O;
+}
+
+// subtract background row `b` from pixels of row `y`
+#define SUBROW(type) do{ \
+    const type *in = IL_ROW(type, I, y); \
+    for(int x = 0; x < w; ++x) out[x] = (float)in[x] - b[x]; \
+    }while(0)
+
+/**
+ * @brief il_Image_subbkg - subtract interpolated background map from image (row by row, without full-frame map)
+ * @param I - image
+ * @param B - its background map
+ * @return float image allocated here or NULL if error
+ */
+il_Image *il_Image_subbkg(const il_Image *I, const il_BkgMap *B){
+    if(!I || !I->data || !B || I->type >= IMTYPE_AMOUNT) return NULL;
+    if(I->width != B->width || I->height != B->height){
+        WARNX("il_Image_subbkg(): wrong map size");
+        return NULL;
+    }
+    int w = I->width, h = I->height;
+    il_Image *O = il_Image_new(w, h, IMTYPE_F);
+    if(!O) return NULL;
+#pragma omp parallel
+{
+    rowws ws;
+    rowws_init(&ws, B);
+    float *b = MALLOC(float, w);
+    #pragma omp for schedule(static)
+    for(int y = 0; y < h; ++y){
+        float *out = IL_ROW(float, O, y);
+        bkg_row(B, B->bkg, B->d2bkg, y, &ws, b);
+        switch(I->type){
+            case IMTYPE_U8:
+                SUBROW(uint8_t);
+            break;
+            case IMTYPE_U16:
+                SUBROW(uint16_t);
+            break;
+            case IMTYPE_U32:
+                SUBROW(uint32_t);
+            break;
+            case IMTYPE_F:
+                SUBROW(float);
+            break;
+            default:
+                SUBROW(double);
+        }
+    }
+    FREE(b);
+    rowws_free(&ws);
+}
+    return O;
+}
+#undef SUBROW
+
+// pack row `y`: bit is set if pixel > t[x]
+#define BINROW(type) do{ \
+    const type *in = IL_ROW(type, I, y); \
+    for(int x = 0; x < w; x += 64){ \
+        int n = (w - x < 64) ? w - x : 64; \
+        uint64_t o = 0; \
+        for(int i = 0; i < n; ++i) o = (o << 1) | ((float)in[x+i] > t[x+i]); \
+        *optr++ = o << (64 - n); \
+    }}while(0)
+
+/**
+ * @brief il_Image2binBkg - binarize image by local threshold: pixel is set if it's above background by
+ *          more than `nsigma` RMS (threshold is calculated row by row, without full-frame map)
+ * @param I - image
+ * @param B - its background map
+ * @param nsigma - threshold in RMS units
+ * @return binary image allocated here or NULL if error
+ */
+il_BinImage *il_Image2binBkg(const il_Image *I, const il_BkgMap *B, double nsigma){
+    if(!I || !I->data || !B || I->type >= IMTYPE_AMOUNT) return NULL;
+    if(I->width != B->width || I->height != B->height){
+        WARNX("il_Image2binBkg(): wrong map size");
+        return NULL;
+    }
+    int w = I->width, h = I->height;
+    il_BinImage *O = il_BinImage_new(w, h);
+    if(!O) return NULL;
+    float k = (float)nsigma;
+#pragma omp parallel
+{
+    rowws ws;
+    rowws_init(&ws, B);
+    float *t = MALLOC(float, w), *r = MALLOC(float, w);
+    #pragma omp for schedule(static)
+    for(int y = 0; y < h; ++y){
+        uint64_t *optr = IL_BINROW(O, y);
+        bkg_row(B, B->bkg, B->d2bkg, y, &ws, t);
+        bkg_row(B, B->rms, B->d2rms, y, &ws, r);
+        for(int x = 0; x < w; ++x) t[x] += k * r[x];
+        switch(I->type){
+            case IMTYPE_U8:
+                BINROW(uint8_t);
+            break;
+            case IMTYPE_U16:
+                BINROW(uint16_t);
+            break;
+            case IMTYPE_U32:
+                BINROW(uint32_t);
+            break;
+            case IMTYPE_F:
+                BINROW(float);
+            break;
+            default:
+                BINROW(double);
+        }
+    }
+    FREE(r); FREE(t);
+    rowws_free(&ws);
+}
+    return O;
+}
+#undef BINROW
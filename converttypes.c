@@ -17,136 +17,479 @@
  */
 
 #include <usefull_macros.h>
+#include <math.h>
 #include <stdio.h>
+#include <string.h>
+#if defined __AVX2__ || defined __SSE2__
+#include <immintrin.h>
+#endif
 
 #include "improclib.h"
 #include "openmp.h"
 
+/*
+ * Unpacking of binary images: byte of packed row (8 pixels) is expanded by lookup table (U8 outputs)
+ * or by variable shifts (wider outputs); the rest of row (less than 8 pixels) - pixel by pixel.
+ */
+// 8 output bytes (0/1 and 0/255) for each input byte; first pixel is MSB
+static uint8_t lut1[256][8], lut255[256][8];
+static void unpack_init(){
+    if(lut1[1][7]) return;
+    for(int i = 0; i < 256; ++i)
+        for(int b = 0; b < 8; ++b)
+            if(i & (0x80 >> b)){
+                lut1[i][b] = 1;
+                lut255[i][b] = 255;
+            }
+}
+
+// unpack row of binary image into bytes using `lut`
+static void unpack_u8(const uint64_t *in, uint8_t *out, int W, uint8_t lut[256][8]){
+    int W8 = W & ~7, x = 0;
+    for(; x < W8; x += 8){
+        uint8_t byte = (uint8_t)(in[x >> 6] >> (56 - (x & 63)));
+        memcpy(out + x, lut[byte], 8); // single 8-byte store
+    }
+    for(; x < W; ++x) out[x] = ((in[x >> 6] >> (63 - (x & 63))) & 1) ? lut[0x80][0] : 0; // lut[0x80][0] is "1"
+}
+
+// unpack row of binary image into 0/1 values of `type`
+#if defined __AVX2__
+static void unpack_u32(const uint64_t *in, uint32_t *out, int W){
+    const __m256i sh = _mm256_setr_epi32(7,6,5,4,3,2,1,0), one = _mm256_set1_epi32(1);
+    int W8 = W & ~7, x = 0;
+    for(; x < W8; x += 8){
+        __m256i v = _mm256_set1_epi32((int)((in[x >> 6] >> (56 - (x & 63))) & 0xff));
+        _mm256_storeu_si256((__m256i*)(out + x), _mm256_and_si256(_mm256_srlv_epi32(v, sh), one));
+    }
+    for(; x < W; ++x) out[x] = (in[x >> 6] >> (63 - (x & 63))) & 1;
+}
+static void unpack_sizet(const uint64_t *in, size_t *out, int W){
+    const __m256i shh = _mm256_setr_epi64x(7,6,5,4), shl = _mm256_setr_epi64x(3,2,1,0), one = _mm256_set1_epi64x(1);
+    int W8 = W & ~7, x = 0;
+    for(; x < W8; x += 8){
+        __m256i v = _mm256_set1_epi64x((long long)((in[x >> 6] >> (56 - (x & 63))) & 0xff));
+        _mm256_storeu_si256((__m256i*)(out + x), _mm256_and_si256(_mm256_srlv_epi64(v, shh), one));
+        _mm256_storeu_si256((__m256i*)(out + x + 4), _mm256_and_si256(_mm256_srlv_epi64(v, shl), one));
+    }
+    for(; x < W; ++x) out[x] = (in[x >> 6] >> (63 - (x & 63))) & 1;
+}
+#else
+// branchless loops: vectorized by compiler
+static void unpack_u32(const uint64_t *in, uint32_t *out, int W){
+    for(int x = 0; x < W; ++x) out[x] = (in[x >> 6] >> (63 - (x & 63))) & 1;
+}
+static void unpack_sizet(const uint64_t *in, size_t *out, int W){
+    for(int x = 0; x < W; ++x) out[x] = (in[x >> 6] >> (63 - (x & 63))) & 1;
+}
+#endif
+
 /**
- * @brief bin2Im - convert binarized image into uint8t
- * @param image - binarized image
- * @param W, H  - its size (in pixels!)
+ * @brief il_bin2ImageT - convert binarized image into image of given kind
+ * @param B - binarized image
+ * @param out - output kind: IL_BIN_U8_255 (U8, 0/255), IL_BIN_U8_1 (U8, 0/1) or IL_BIN_U32 (U32, 0/1)
  * @return Image structure
  */
-il_Image *il_bin2Image(const uint8_t *image, int W, int H){
-    il_Image *ret = il_Image_new(W, H, IMTYPE_U8);
-    int stride = (W + 7) / 8, s1 = (stride*8 == W) ? stride : stride - 1;
-    uint8_t *data = (uint8_t*) ret->data;
-    int rest = W - s1*8;
-    OMP_FOR()
-    for(int y = 0; y < H; y++){
-        uint8_t *optr = &data[y*W];
-        const uint8_t *iptr = &image[y*stride];
-        for(int x = 0; x < s1; x++){
-            register uint8_t inp = *iptr++;
-            for(int i = 0; i < 8; ++i){
-                *optr++ = (inp & 0x80) ? 255 : 0;
-                inp <<= 1;
-            }
-        }
-        if(rest){
-            register uint8_t inp = *iptr;
-            for(int i = 0; i < rest; ++i){
-                *optr++ = (inp & 0x80) ? 255 : 0;
-                inp <<= 1;
-            }
-        }
+il_Image *il_bin2ImageT(const il_BinImage *B, il_binout_t out){
+    return il_bin2ImageTP(NULL, B, out);
+}
+// the same as il_bin2ImageT but with image from pool `p`
+il_Image *il_bin2ImageTP(il_ImagePool *p, const il_BinImage *B, il_binout_t out){
+    if(!B || !B->data) return NULL;
+    int W = B->width, H = B->height;
+    il_Image *ret = NULL;
+    unpack_init();
+    switch(out){
+        case IL_BIN_U8_255:
+        case IL_BIN_U8_1:
+            ret = il_Image_newP(p, W, H, IMTYPE_U8);
+            if(!ret) return NULL;
+            uint8_t (*lut)[8] = (out == IL_BIN_U8_1) ? lut1 : lut255;
+            OMP_FOR(schedule(static))
+            for(int y = 0; y < H; y++)
+                unpack_u8(IL_BINROW(B, y), IL_ROW(uint8_t, ret, y), W, lut);
+            ret->maxval = (out == IL_BIN_U8_1) ? 1 : 255;
+        break;
+        case IL_BIN_U32:
+            ret = il_Image_newP(p, W, H, IMTYPE_U32);
+            if(!ret) return NULL;
+            OMP_FOR(schedule(static))
+            for(int y = 0; y < H; y++)
+                unpack_u32(IL_BINROW(B, y), IL_ROW(uint32_t, ret, y), W);
+            ret->maxval = 1;
+        break;
+        default:
+            WARNX("il_bin2ImageT(): wrong output kind %d", out);
+            return NULL;
     }
     ret->minval = 0;
-    ret->maxval = 255;
     return ret;
 }
 
 /**
- * Convert image into pseudo-packed (1 char == 8 pixels), all values > bk will be 1, else - 0
- * @param im (i)     - image to convert
- * @param stride (o) - new width of image
+ * @brief bin2Im - convert binarized image into uint8t (0 and 255)
+ * @param B - binarized image
+ * @return Image structure
+ */
+il_Image *il_bin2Image(const il_BinImage *B){
+    return il_bin2ImageTP(NULL, B, IL_BIN_U8_255);
+}
+// the same as il_bin2Image but with image from pool `p`
+il_Image *il_bin2ImageP(il_ImagePool *p, const il_BinImage *B){
+    return il_bin2ImageTP(p, B, IL_BIN_U8_255);
+}
+
+/*
+ * Pixel `p` of integer image is set if p > bk, i.e. if p >= t1 = floor(bk) + 1;
+ * for unsigned integers p >= t1 <=> max(p, t1) == p - so we need only max and compare for equality.
+ * Words are filled from MSB (first pixel) to LSB.
+ */
+#if defined __AVX2__
+// movemask of 32 bytes with reversed order: first byte -> MSB
+static inline uint32_t rmovemask(__m256i v){
+    const __m256i rev = _mm256_setr_epi8(15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0,
+                                         15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0);
+    v = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(v, rev), 0x4E);
+    return (uint32_t)_mm256_movemask_epi8(v);
+}
+// 64 U8 pixels -> one word
+static inline uint64_t bin64u8(const uint8_t *in, __m256i t1){
+    __m256i v0 = _mm256_loadu_si256((const __m256i*)in), v1 = _mm256_loadu_si256((const __m256i*)(in + 32));
+    v0 = _mm256_cmpeq_epi8(_mm256_max_epu8(v0, t1), v0);
+    v1 = _mm256_cmpeq_epi8(_mm256_max_epu8(v1, t1), v1);
+    return ((uint64_t)rmovemask(v0) << 32) | rmovemask(v1);
+}
+// 32 U16 pixels -> 32 bits
+static inline uint32_t bin32u16(const uint16_t *in, __m256i t1){
+    __m256i v0 = _mm256_loadu_si256((const __m256i*)in), v1 = _mm256_loadu_si256((const __m256i*)(in + 16));
+    v0 = _mm256_cmpeq_epi16(_mm256_max_epu16(v0, t1), v0);
+    v1 = _mm256_cmpeq_epi16(_mm256_max_epu16(v1, t1), v1);
+    // packs mixes 128-bit lanes: restore order of 64-bit parts
+    return rmovemask(_mm256_permute4x64_epi64(_mm256_packs_epi16(v0, v1), 0xD8));
+}
+static inline uint64_t bin64u16(const uint16_t *in, __m256i t1){
+    return ((uint64_t)bin32u16(in, t1) << 32) | bin32u16(in + 32, t1);
+}
+// 8 bits from 8 lanes of 32 bits (first lane -> MSB)
+static uint8_t rev8[256];
+static void rev8_init(){
+    if(rev8[128]) return;
+    for(int i = 0; i < 256; ++i){
+        uint8_t r = 0;
+        for(int b = 0; b < 8; ++b) if(i & (1<<b)) r |= 0x80 >> b;
+        rev8[i] = r;
+    }
+}
+static inline uint64_t bin64u32(const uint32_t *in, __m256i t1){
+    uint64_t o = 0;
+    for(int k = 0; k < 64; k += 8){
+        __m256i v = _mm256_loadu_si256((const __m256i*)(in + k));
+        v = _mm256_cmpeq_epi32(_mm256_max_epu32(v, t1), v);
+        o = (o << 8) | rev8[_mm256_movemask_ps(_mm256_castsi256_ps(v))];
+    }
+    return o;
+}
+static inline uint64_t bin64f(const float *in, __m256 t){
+    uint64_t o = 0;
+    for(int k = 0; k < 64; k += 8){
+        __m256 v = _mm256_cmp_ps(_mm256_loadu_ps(in + k), t, _CMP_GT_OQ);
+        o = (o << 8) | rev8[_mm256_movemask_ps(v)];
+    }
+    return o;
+}
+static inline uint64_t bin64d(const double *in, __m256d t){
+    uint64_t o = 0;
+    for(int k = 0; k < 64; k += 8){
+        __m256d v0 = _mm256_cmp_pd(_mm256_loadu_pd(in + k), t, _CMP_GT_OQ);
+        __m256d v1 = _mm256_cmp_pd(_mm256_loadu_pd(in + k + 4), t, _CMP_GT_OQ);
+        o = (o << 8) | rev8[_mm256_movemask_pd(v0) | (_mm256_movemask_pd(v1) << 4)];
+    }
+    return o;
+}
+#elif defined __SSE2__
+static uint8_t rev8[256];
+static void rev8_init(){
+    if(rev8[128]) return;
+    for(int i = 0; i < 256; ++i){
+        uint8_t r = 0;
+        for(int b = 0; b < 8; ++b) if(i & (1<<b)) r |= 0x80 >> b;
+        rev8[i] = r;
+    }
+}
+// 64 U8 pixels -> one word
+static inline uint64_t bin64u8(const uint8_t *in, __m128i t1){
+    uint64_t o = 0;
+    for(int k = 0; k < 4; ++k){
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + 16*k));
+        v = _mm_cmpeq_epi8(_mm_max_epu8(v, t1), v);
+        unsigned m = (unsigned)_mm_movemask_epi8(v); // bit i - pixel i
+        o = (o << 16) | ((uint64_t)rev8[m & 0xff] << 8) | rev8[m >> 8];
+    }
+    return o;
+}
+#endif
+
+// binarize rows [y0, y1) of image `im` by condition `cond` on pixel value `p`;
+// `simd` is vectorized loop by whole words
+#define BINROWS(type, cond, simd) \
+    OMP_FOR(schedule(static)) \
+    for(int y = y0; y < y1; ++y){ \
+        const type *iptr = IL_ROW(type, im, y); \
+        uint64_t *optr = IL_BINROW(out, y); \
+        int x = 0; \
+        simd; \
+        for(; x < W; x += 64){ \
+            int n = (W - x < 64) ? W - x : 64; \
+            register uint64_t o = 0; \
+            for(int i = 0; i < n; ++i){ \
+                type p = iptr[x+i]; \
+                o <<= 1; \
+                if(cond) o |= 1; \
+            } \
+            *optr++ = o << (64 - n); \
+        } \
+    }
+
+// set all pixels in rows [y0, y1) of `out` to zero
+static void bin_zero(il_BinImage *out, int y0, int y1){
+    size_t len = ((out->width + 63) / 64) * sizeof(uint64_t);
+    OMP_FOR(schedule(static))
+    for(int y = y0; y < y1; ++y) memset(IL_BINROW(out, y), 0, len);
+}
+
+static void bin_u8(const il_Image *im, double bk, il_BinImage *out, int y0, int y1){
+    if(bk >= 255.){ bin_zero(out, y0, y1); return; }
+    int W = im->width;
+    uint8_t thres = (bk < 0.) ? 0 : (uint8_t)(floor(bk) + 1.); // p > bk <=> p >= thres
+#if defined __AVX2__
+    __m256i t1 = _mm256_set1_epi8((char)thres);
+    BINROWS(uint8_t, p >= thres, for(; x + 64 <= W; x += 64) *optr++ = bin64u8(iptr + x, t1));
+#elif defined __SSE2__
+    rev8_init();
+    __m128i t1 = _mm_set1_epi8((char)thres);
+    BINROWS(uint8_t, p >= thres, for(; x + 64 <= W; x += 64) *optr++ = bin64u8(iptr + x, t1));
+#else
+    BINROWS(uint8_t, p >= thres, );
+#endif
+}
+
+static void bin_u16(const il_Image *im, double bk, il_BinImage *out, int y0, int y1){
+    if(bk >= 65535.){ bin_zero(out, y0, y1); return; }
+    int W = im->width;
+    uint16_t thres = (bk < 0.) ? 0 : (uint16_t)(floor(bk) + 1.);
+#if defined __AVX2__
+    __m256i t1 = _mm256_set1_epi16((short)thres);
+    BINROWS(uint16_t, p >= thres, for(; x + 64 <= W; x += 64) *optr++ = bin64u16(iptr + x, t1));
+#else
+    BINROWS(uint16_t, p >= thres, );
+#endif
+}
+
+static void bin_u32(const il_Image *im, double bk, il_BinImage *out, int y0, int y1){
+    if(bk >= (double)UINT32_MAX){ bin_zero(out, y0, y1); return; }
+    int W = im->width;
+    uint32_t thres = (bk < 0.) ? 0 : (uint32_t)(floor(bk) + 1.);
+#if defined __AVX2__
+    rev8_init();
+    __m256i t1 = _mm256_set1_epi32((int)thres);
+    BINROWS(uint32_t, p >= thres, for(; x + 64 <= W; x += 64) *optr++ = bin64u32(iptr + x, t1));
+#else
+    BINROWS(uint32_t, p >= thres, );
+#endif
+}
+
+static void bin_f(const il_Image *im, double bk, il_BinImage *out, int y0, int y1){
+    int W = im->width;
+    // for float p: p > bk <=> p > thres
+    float thres = (float)bk;
+    if((double)thres > bk) thres = nextafterf(thres, -INFINITY);
+#if defined __AVX2__
+    rev8_init();
+    __m256 t = _mm256_set1_ps(thres);
+    BINROWS(float, p > thres, for(; x + 64 <= W; x += 64) *optr++ = bin64f(iptr + x, t));
+#else
+    BINROWS(float, p > thres, );
+#endif
+}
+
+static void bin_d(const il_Image *im, double bk, il_BinImage *out, int y0, int y1){
+    int W = im->width;
+#if defined __AVX2__
+    rev8_init();
+    __m256d t = _mm256_set1_pd(bk);
+    BINROWS(double, p > bk, for(; x + 64 <= W; x += 64) *optr++ = bin64d(iptr + x, t));
+#else
+    BINROWS(double, p > bk, );
+#endif
+}
+#undef BINROWS
+
+// binarize rows [y0, y1) of image `im` into `out`; return FALSE if type is wrong
+static int bin_rows(const il_Image *im, double bk, il_BinImage *out, int y0, int y1){
+    switch(im->type){
+        case IMTYPE_U8:
+            bin_u8(im, bk, out, y0, y1);
+        break;
+        case IMTYPE_U16:
+            bin_u16(im, bk, out, y0, y1);
+        break;
+        case IMTYPE_U32:
+            bin_u32(im, bk, out, y0, y1);
+        break;
+        case IMTYPE_F:
+            bin_f(im, bk, out, y0, y1);
+        break;
+        case IMTYPE_D:
+            bin_d(im, bk, out, y0, y1);
+        break;
+        default:
+            WARNX("ilImage2bin(): unsupported image type %d", im->type);
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * Convert image into packed binary image, all values > bk will be 1, else - 0
+ * @param im (i)     - image to convert (any type)
  * @param bk         - background level (all values < bk will be 0, other will be 1)
- * @return allocated memory area with "packed" image
+ * @return allocated here binary image or NULL if error (e.g. bk is NaN)
  */
-uint8_t *il_Image2bin(const il_Image *im, double bk){
-    if(!im) return NULL;
-    if(im->type != IMTYPE_U8){
-        WARNX("ilImage2bin(): supported only 8-bit images");
+il_BinImage *il_Image2bin(const il_Image *im, double bk){
+    return il_Image2binP(NULL, im, bk);
+}
+// the same as il_Image2bin but with image from pool `p` (return it by il_BinImage_free())
+il_BinImage *il_Image2binP(il_ImagePool *p, const il_Image *im, double bk){
+    if(!im || !im->data) return NULL;
+    if(isnan(bk)){
+        WARNX("il_Image2bin(): background level is NaN");
         return NULL;
     }
     int W = im->width, H = im->height;
     if(W < 2 || H < 2) return NULL;
-    int y, W0 = (W + 7) / 8, s1 = (W/8 == W0) ? W0 : W0 - 1;
-    uint8_t *ret = MALLOC(uint8_t, W0 * H);
-    uint8_t *data = (uint8_t*) im->data;
-    int rest = W - s1*8;
-    //OMP_FOR()
-    for(y = 0; y < H; ++y){
-        uint8_t *iptr = &data[y*W];
-        uint8_t *optr = &ret[y*W0];
-        for(int x = 0; x < s1; ++x){
-            register uint8_t o = 0;
-            for(int i = 0; i < 8; ++i){
-                o <<= 1;
-                if(*iptr++ > bk) o |= 1;
-            }
-            *optr++ = o;
-        }
-        if(rest){
-            register uint8_t o = 0;
-            for(int x = 0; x < rest; ++x){
-                o <<= 1;
-                if(*iptr++ > bk) o |= 1;
-            }
-            *optr = o << (8 - rest);
-        }
-    }
+    il_BinImage *ret = il_BinImage_newP(p, W, H);
+    if(!ret) return NULL;
+    if(!bin_rows(im, bk, ret, 0, H)) il_BinImage_free(&ret);
     return ret;
 }
 
-// transformation functions for Im2u8
-#define TRANSMACRO(datatype)  \
-    int height = I->height, width = I->width, stride = width * nchannels;  \
+/**
+ * @brief il_Image2binS - the same as il_Image2bin but band by band (for mmap'ed images larger than RAM)
+ * @param im - image
+ * @param bk - background level
+ * @param out (o) - binary image of the same size (e.g. il_BinImage_mmap with IL_MMAP_CREATE)
+ * @param bandh - band height (rows) or 0 for IL_BANDHEIGHT
+ * @return FALSE if error (e.g. bk is NaN)
+ */
+int il_Image2binS(const il_Image *im, double bk, il_BinImage *out, int bandh){
+    if(!im || !im->data || !out || !out->data) return FALSE;
+    if(isnan(bk)){
+        WARNX("ilImage2binS(): background level is NaN");
+        return FALSE;
+    }
+    if(im->width != out->width || im->height != out->height){
+        WARNX("ilImage2binS(): wrong output image size");
+        return FALSE;
+    }
+    if(bandh < 1) bandh = IL_BANDHEIGHT;
+    int H = im->height;
+    for(int y0 = 0; y0 < H; y0 += bandh){
+        int y1 = (y0 + bandh < H) ? y0 + bandh : H;
+        il_Image_advise(im, y1, bandh, IL_ADV_WILLNEED);
+        if(!bin_rows(im, bk, out, y0, y1)) return FALSE;
+        il_Image_advise(im, y0, y1 - y0, IL_ADV_DONTNEED);
+        il_BinImage_advise(out, y0, y1 - y0, IL_ADV_DONTNEED);
+    }
+    return TRUE;
+}
+
+// expand mono row `in` of `w` bytes into 3-channel row `out` (each byte is repeated three times)
+static void expand3(const uint8_t *in, uint8_t *out, int w){
+    int x = 0;
+#if defined __SSSE3__
+    // 16 input bytes -> 48 output bytes by three shuffles of the same register
+    const __m128i m0 = _mm_setr_epi8(0,0,0,1,1,1,2,2,2,3,3,3,4,4,4,5),
+                  m1 = _mm_setr_epi8(5,5,6,6,6,7,7,7,8,8,8,9,9,9,10,10),
+                  m2 = _mm_setr_epi8(10,11,11,11,12,12,12,13,13,13,14,14,14,15,15,15);
+    for(; x + 16 <= w; x += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + x));
+        uint8_t *o = out + 3*x;
+        _mm_storeu_si128((__m128i*)o, _mm_shuffle_epi8(v, m0));
+        _mm_storeu_si128((__m128i*)(o + 16), _mm_shuffle_epi8(v, m1));
+        _mm_storeu_si128((__m128i*)(o + 32), _mm_shuffle_epi8(v, m2));
+    }
+#endif
+    for(; x < w; ++x) out[3*x] = out[3*x+1] = out[3*x+2] = in[x];
+}
+
+// transformation functions for Im2u8: `conv` converts pixel `p` into byte; for 3 channels mono row is
+// converted into per-thread buffer and then expanded
+#define TRANSMACRO(datatype, conv)  \
+    int height = I->height, width = I->width; \
+    size_t stride = (size_t)width * nchannels; \
     uint8_t *outp = MALLOC(uint8_t, height * stride); \
-    double min = I->minval, max = I->maxval, W = 255./(max - min); \
-    datatype *Idata = (datatype*) I->data; \
-    if(nchannels == 3){ \
-        OMP_FOR() \
+    _Pragma("omp parallel") \
+    { \
+        uint8_t *mono = (nchannels == 3) ? MALLOC(uint8_t, width) : NULL; \
+        _Pragma("omp for schedule(static)") \
         for(int y = 0; y < height; ++y){ \
-            uint8_t *Out = &outp[y*stride]; \
-            datatype *In = &Idata[y*width]; \
+            uint8_t *restrict Out = mono ? mono : &outp[(size_t)y*stride]; \
+            const datatype *restrict In = IL_ROW(datatype, I, y); \
             for(int x = 0; x < width; ++x){ \
-                Out[0] = Out[1] = Out[2] = (uint8_t)(W*((double)(*In++) - min)); \
-                Out += 3; \
-            } \
-        } \
-    }else{ \
-        OMP_FOR() \
-        for(int y = 0; y < height; ++y){ \
-            uint8_t *Out = &outp[y*stride]; \
-            datatype *In = &Idata[y*width]; \
-            for(int x = 0; x < width; ++x){ \
-                *Out++ = (uint8_t)(W*((double)(*In++) - min)); \
+                datatype p = In[x]; \
+                Out[x] = conv; \
             } \
+            if(mono) expand3(mono, &outp[(size_t)y*stride], width); \
         } \
+        FREE(mono); \
+    }
+
+// fill all `n` entries of lookup table: values out of cached [minval, maxval] (if data was changed without
+// il_Image_modified()) are saturated
+static void fill_lut(const il_Image *I, uint8_t *lut, int n){
+    int min = (int)I->minval, max = (int)I->maxval;
+    double W = 255./(I->maxval - I->minval);
+    for(int v = 0; v < n; ++v){
+        if(v < min) lut[v] = 0;
+        else if(v > max) lut[v] = 255;
+        else lut[v] = (uint8_t)(W*((double)v - I->minval));
     }
+}
 
+// integer images with small dynamic range: lookup table is exact and cheap
 static uint8_t *Iu8(const il_Image *I, int nchannels){
-    TRANSMACRO(uint8_t);
+    uint8_t lut[256];
+    fill_lut(I, lut, 256);
+    TRANSMACRO(uint8_t, lut[p]);
     return outp;
 }
 static uint8_t *Iu16(const il_Image *I, int nchannels){
-    TRANSMACRO(uint16_t);
+    uint8_t *lut = MALLOC(uint8_t, 65536);
+    fill_lut(I, lut, 65536);
+    TRANSMACRO(uint16_t, lut[p]);
+    FREE(lut);
     return outp;
 }
 static uint8_t *Iu32(const il_Image *I, int nchannels){
-    TRANSMACRO(uint32_t);
+    double min = I->minval, W = 255./(I->maxval - min);
+    TRANSMACRO(uint32_t, (uint8_t)(W*((double)p - min)));
     return outp;
 }
+// float image: single-precision arithmetic (8 pixels per AVX register)
 static uint8_t *If(const il_Image *I, int nchannels){
-    TRANSMACRO(float);
+    float min = (float)I->minval, W = (float)(255./(I->maxval - I->minval));
+    TRANSMACRO(float, (uint8_t)(W*(p - min)));
     return outp;
 }
+// double image: offset is subtracted in double (data could have large offset and small range), scaling -
+// in single precision (enough for 8-bit result)
 static uint8_t *Id(const il_Image *I, int nchannels){
-    TRANSMACRO(double);
+    double min = I->minval;
+    float W = (float)(255./(I->maxval - min));
+    TRANSMACRO(double, (uint8_t)(W*(float)(p - min)));
     return outp;
 }
+#undef TRANSMACRO
 
 /**
  * @brief il_Image2u8 - linear transform for preparing file to save as JPEG or other type
@@ -180,12 +523,165 @@ uint8_t *il_Image2u8(il_Image *I, int nchannels){ // only 1 and 3 channels suppo
     return NULL;
 }
 
+/*
+ * Conversion between pixel types: dst = src*scale + offset. Integer outputs are rounded to nearest and
+ * saturated to [0, max of type] (NaN gives 0), floating outputs are simple casts. All kernels are vectorized
+ * by compiler; conversion is limited by memory bandwidth, so lookup tables for U8/U16 sources give no gain.
+ */
+typedef struct convctx convctx;
+// convert row of `w` pixels
+typedef void (*convrow)(const void *in, void *out, int w, const convctx *c);
+struct convctx{
+    convrow fn;         // row kernel
+    double scale;       // dst = src*scale + offset
+    double offset;
+    int pixbytes;       // source pixel size for conv_copy
+};
+
+// `itype` is intermediate signed integer which lets compiler vectorize conversion from double
+#define CONVINT(stype, dtype, itype, dmax) \
+static void conv_##stype##_##dtype(const void *i, void *o, int w, const convctx *c){ \
+    const stype *restrict in = (const stype*)i; \
+    dtype *restrict out = (dtype*)o; \
+    double scale = c->scale, offset = c->offset + 0.5; \
+    for(int x = 0; x < w; ++x){ \
+        double v = (double)in[x] * scale + offset; \
+        out[x] = (dtype)(itype)(v > 0. ? (v < dmax ? v : dmax) : 0.); \
+    } \
+}
+#define CONVFLT(stype, dtype) \
+static void conv_##stype##_##dtype(const void *i, void *o, int w, const convctx *c){ \
+    const stype *restrict in = (const stype*)i; \
+    dtype *restrict out = (dtype*)o; \
+    double scale = c->scale, offset = c->offset; \
+    for(int x = 0; x < w; ++x) out[x] = (dtype)((double)in[x] * scale + offset); \
+}
+#define CONVALL(stype) \
+    CONVINT(stype, uint8_t, int32_t, 255.) \
+    CONVINT(stype, uint16_t, int32_t, 65535.) \
+    CONVINT(stype, uint32_t, int64_t, 4294967295.) \
+    CONVFLT(stype, float) \
+    CONVFLT(stype, double)
+
+CONVALL(uint8_t)
+CONVALL(uint16_t)
+CONVALL(uint32_t)
+CONVALL(float)
+CONVALL(double)
+
+#define CONVTAB(stype)  {conv_##stype##_uint8_t, conv_##stype##_uint16_t, conv_##stype##_uint32_t, \
+                         conv_##stype##_float, conv_##stype##_double}
+// [src type][dst type]
+static const convrow convtab[IMTYPE_AMOUNT][IMTYPE_AMOUNT] = {
+    CONVTAB(uint8_t), CONVTAB(uint16_t), CONVTAB(uint32_t), CONVTAB(float), CONVTAB(double)
+};
+#undef CONVINT
+#undef CONVFLT
+#undef CONVALL
+#undef CONVTAB
+
+// copy row without changes
+static void conv_copy(const void *i, void *o, int w, const convctx *c){
+    memcpy(o, i, (size_t)w * c->pixbytes);
+}
+
+/**
+ * @brief conv_prepare - choose row kernel for conversion src->type
+ * @param src - source image
+ * @param type - destination type
+ * @param scale, offset - linear transform parameters
+ * @param c (o) - context
+ */
+static void conv_prepare(const il_Image *src, il_imtype_t type, double scale, double offset, convctx *c){
+    c->fn = convtab[src->type][type];
+    c->scale = scale;
+    c->offset = offset;
+    c->pixbytes = src->pixbytes;
+    if(src->type == type && scale == 1. && offset == 0.) c->fn = conv_copy;
+}
+
+// convert all rows of `src` into `dst` (the same memory if converted in-place)
+static void conv_rows(const il_Image *src, il_Image *dst, const convctx *c){
+    int w = src->width, h = src->height;
+    if(src->data != dst->data){
+        OMP_FOR(schedule(static))
+        for(int y = 0; y < h; ++y)
+            c->fn(IL_ROW(uint8_t, src, y), IL_ROW(uint8_t, dst, y), w, c);
+        return;
+    }
+    // in-place: kernels have `restrict` pointers, so each row is converted through buffer
+    size_t rowbytes = (size_t)w * dst->pixbytes;
+#pragma omp parallel
+{
+    uint8_t *buf = MALLOC(uint8_t, rowbytes);
+    #pragma omp for schedule(static)
+    for(int y = 0; y < h; ++y){
+        c->fn(IL_ROW(uint8_t, src, y), buf, w, c);
+        memcpy(IL_ROW(uint8_t, dst, y), buf, rowbytes);
+    }
+    FREE(buf);
+}
+}
+
+/**
+ * @brief il_Image_convert - convert image into other pixel type: dst = src*scale + offset;
+ *          values of integer types are rounded and saturated ([0, 255] for U8 etc)
+ * @param src - input image
+ * @param type - output pixel type
+ * @param scale, offset - linear transform parameters
+ * @return image allocated here or NULL if error
+ */
+il_Image *il_Image_convert(const il_Image *src, il_imtype_t type, double scale, double offset){
+    return il_Image_convertP(NULL, src, type, scale, offset);
+}
+// the same as il_Image_convert but with output image from pool `p`
+il_Image *il_Image_convertP(il_ImagePool *p, const il_Image *src, il_imtype_t type, double scale, double offset){
+    if(!src || !src->data || src->type >= IMTYPE_AMOUNT || type >= IMTYPE_AMOUNT) return NULL;
+    il_Image *dst = il_Image_newP(p, src->width, src->height, type);
+    if(!dst) return NULL;
+    convctx c;
+    conv_prepare(src, type, scale, offset, &c);
+    conv_rows(src, dst, &c);
+    return dst;
+}
+
+/**
+ * @brief il_Image_convert_inplace - the same as il_Image_convert but result is stored in the same memory
+ *          (pitch isn't changed); possible only if new type isn't wider than old and image isn't a view
+ * @param I - image to convert
+ * @param type - new pixel type
+ * @param scale, offset - linear transform parameters
+ * @return FALSE if error
+ */
+int il_Image_convert_inplace(il_Image *I, il_imtype_t type, double scale, double offset){
+    if(!I || !I->data || I->type >= IMTYPE_AMOUNT || type >= IMTYPE_AMOUNT) return FALSE;
+    if(I->parent){
+        WARNX("il_Image_convert_inplace(): can't change type of view");
+        return FALSE;
+    }
+    if(il_getpixbytes(type) > I->pixbytes){
+        WARNX("il_Image_convert_inplace(): new type is wider than old");
+        return FALSE;
+    }
+    convctx c;
+    conv_prepare(I, type, scale, offset, &c);
+    if(c.fn == conv_copy) return TRUE;
+    il_Image dst = *I;
+    dst.type = type;
+    dst.pixbytes = il_getpixbytes(type);
+    conv_rows(I, &dst, &c);
+    I->type = dst.type;
+    I->pixbytes = dst.pixbytes;
+    il_Image_modified(I);
+    return TRUE;
+}
+
 #if 0
 UNUSED function! Need to be refactored
 // convert size_t labels into Image
 Image *ST2Im(const size_t *image, int W, int H){
     Image *ret = Image_new(W, H);
-    OMP_FOR()
+    OMP_FOR(schedule(static))
     for(int y = 0; y < H; ++y){
         Imtype *optr = &ret->data[y*W];
         const size_t *iptr = &image[y*W];
@@ -199,33 +695,20 @@ Image *ST2Im(const size_t *image, int W, int H){
 #endif
 
 /**
- * Convert "packed" image into size_t array for conncomp procedure
- * @param image (i) - input image
- * @param W, H      - size of image in pixels
+ * Convert packed binary image into size_t array for conncomp procedure
+ * @param B (i) - input image
  * @return allocated memory area with copy of an image
  */
-size_t *il_bin2sizet(const uint8_t *image, int W, int H){
-    size_t *ret = MALLOC(size_t, W * H);
-    int W0 = (W + 7) / 8, s1 = W0 - 1;
-    OMP_FOR()
-    for(int y = 0; y < H; y++){
-        size_t *optr = &ret[y*W];
-        const uint8_t *iptr = &image[y*W0];
-        for(int x = 0; x < s1; ++x){
-            register uint8_t inp = *iptr++;
-            for(int i = 0; i < 8; ++i){
-                *optr++ = (inp & 0x80) ? 1 : 0;
-                inp <<= 1;
-            }
-        }
-        int rest = W - s1*8;
-        if(rest){
-            register uint8_t inp = *iptr;
-            for(int i = 0; i < rest; ++i){
-                *optr++ = (inp & 0x80) ? 1 : 0;
-                inp <<= 1;
-            }
-        }
-    }
+size_t *il_bin2sizet(const il_BinImage *B){
+    return il_bin2sizetP(NULL, B);
+}
+// the same as il_bin2sizet but with buffer from pool `p` (return it by il_ImagePool_put())
+size_t *il_bin2sizetP(il_ImagePool *p, const il_BinImage *B){
+    if(!B || !B->data) return NULL;
+    int W = B->width, H = B->height;
+    size_t *ret = il_ImagePool_getbuf(p, sizeof(size_t) * (size_t)W * H);
+    OMP_FOR(schedule(static))
+    for(int y = 0; y < H; y++)
+        unpack_sizet(IL_BINROW(B, y), &ret[(size_t)y*W], W);
     return ret;
 }
@@ -42,7 +42,7 @@ il_Img3 *il_Img3_new(int w, int h){
     if(w < 1 || h < 1) return NULL;
     il_Img3 *o = MALLOC(il_Img3, 1);
     if(!o) return NULL;
-    o->data = MALLOC(uint8_t, 3*w*h);
+    o->data = MALLOC(uint8_t, 3*(size_t)w*h);
     if(!o->data){
         FREE(o);
         return NULL;
@@ -57,11 +57,95 @@ void il_Img3_free(il_Img3 **I){
     FREE(*I);
 }
 
+/**
+ * @brief il_Img3p_new - allocate planar 3-channel image (all planes in one memory block)
+ * @param w, h - image size
+ * @return image allocated here or NULL if error
+ */
+il_Img3p *il_Img3p_new(int w, int h){
+    if(w < 1 || h < 1) return NULL;
+    il_Img3p *o = MALLOC(il_Img3p, 1);
+    size_t plsz = (size_t)w * h;
+    plsz = (plsz + IL_ALIGN - 1) / IL_ALIGN * IL_ALIGN; // each plane starts aligned
+    o->data = il_alloc_rows(plsz, 3);
+    for(int c = 0; c < 3; ++c) o->plane[c] = o->data + c*plsz;
+    o->width = w;
+    o->height = h;
+    return o;
+}
+void il_Img3p_free(il_Img3p **I){
+    if(!I || !*I) return;
+    FREE((*I)->data);
+    FREE(*I);
+}
+
+/**
+ * @brief il_Img3_deinterleave - convert interleaved image into planar
+ * @param I - input image
+ * @param P (o) - output image (should have the same size)
+ * @return FALSE if error
+ */
+int il_Img3_deinterleave(const il_Img3 *I, il_Img3p *P){
+    if(!I || !P || !I->data || !P->data || I->width != P->width || I->height != P->height) return FALSE;
+    int w = I->width, h = I->height;
+    OMP_FOR()
+    for(int y = 0; y < h; ++y){ // simple loops with restrict pointers are vectorized by compiler
+        size_t idx = (size_t)y * w;
+        const uint8_t *restrict in = I->data + 3*idx;
+        uint8_t *restrict r = P->plane[0] + idx, *restrict g = P->plane[1] + idx, *restrict b = P->plane[2] + idx;
+        for(int x = 0; x < w; ++x){
+            r[x] = in[3*x];
+            g[x] = in[3*x+1];
+            b[x] = in[3*x+2];
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * @brief il_Img3p_interleave - convert planar image into interleaved
+ * @param P - input image
+ * @param I (o) - output image (should have the same size)
+ * @return FALSE if error
+ */
+int il_Img3p_interleave(const il_Img3p *P, il_Img3 *I){
+    if(!I || !P || !I->data || !P->data || I->width != P->width || I->height != P->height) return FALSE;
+    int w = I->width, h = I->height;
+    OMP_FOR()
+    for(int y = 0; y < h; ++y){
+        size_t idx = (size_t)y * w;
+        uint8_t *restrict out = I->data + 3*idx;
+        const uint8_t *restrict r = P->plane[0] + idx, *restrict g = P->plane[1] + idx, *restrict b = P->plane[2] + idx;
+        for(int x = 0; x < w; ++x){
+            out[3*x] = r[x];
+            out[3*x+1] = g[x];
+            out[3*x+2] = b[x];
+        }
+    }
+    return TRUE;
+}
+
+// allocate interleaved copy of planar image
+il_Img3 *il_Img3p2Img3(const il_Img3p *P){
+    if(!P || !P->data) return NULL;
+    il_Img3 *I = il_Img3_new(P->width, P->height);
+    if(!il_Img3p_interleave(P, I)) il_Img3_free(&I);
+    return I;
+}
+
+// allocate planar copy of interleaved image
+il_Img3p *il_Img32Img3p(const il_Img3 *I){
+    if(!I || !I->data) return NULL;
+    il_Img3p *P = il_Img3p_new(I->width, I->height);
+    if(!il_Img3_deinterleave(I, P)) il_Img3p_free(&P);
+    return P;
+}
+
 il_Pattern *il_Pattern_new(int w, int h){
     if(w < 1 || h < 1) return NULL;
     il_Pattern *o = MALLOC(il_Pattern, 1);
     if(!o) return NULL;
-    o->data = MALLOC(uint8_t, w*h);
+    o->data = MALLOC(uint8_t, (size_t)w*h);
     if(!o->data){
         FREE(o);
         return NULL;
@@ -109,12 +193,12 @@ il_Pattern *il_Pattern_xcross(int w, int h){
     return p;
 }
 
-#define DRAW_star(type, max) \
+#define DRAW_star(type, max, pitch) \
 OMP_FOR() \
 for(int y = 0; y < h; ++y){ \
     double ry2 = (double)(y-h2); \
     ry2 *= ry2; \
-    type *data = &((type*)(p->data))[y*w]; \
+    type *data = (type*)((uint8_t*)p->data + (size_t)y*(pitch)); \
         for(int x = 0; x < w; ++x, ++data){ \
         double rx = (double)(x-w2); \
         double Intens = max * pow(1. + (rx*rx + ry2)/theta2, -beta); \
@@ -137,7 +221,7 @@ il_Pattern *il_Pattern_star(int w, int h, double fwhm, double beta){
     if(!p) return NULL;
     int w2 = w/2, h2 = h/2; // center of image
     double hwhm = fwhm / 2., theta2 = hwhm*hwhm;
-    DRAW_star(uint8_t, 255.);
+    DRAW_star(uint8_t, 255., w);
     return p;
 }
 
@@ -158,19 +242,19 @@ il_Image *il_Image_star(il_imtype_t type, int w, int h, double fwhm, double beta
     double hwhm = fwhm / 2., theta2 = hwhm*hwhm;
     switch(type){
         case IMTYPE_U8:
-            DRAW_star(uint8_t, UINT8_MAX);
+            DRAW_star(uint8_t, UINT8_MAX, p->pitch);
         break;
         case IMTYPE_U16:
-            DRAW_star(uint16_t, UINT16_MAX);
+            DRAW_star(uint16_t, UINT16_MAX, p->pitch);
         break;
         case IMTYPE_U32:
-            DRAW_star(uint32_t, UINT32_MAX);
+            DRAW_star(uint32_t, UINT32_MAX, p->pitch);
         break;
         case IMTYPE_F:
-            DRAW_star(float, 1.);
+            DRAW_star(float, 1., p->pitch);
         break;
         case IMTYPE_D:
-            DRAW_star(double, 1.);
+            DRAW_star(double, 1., p->pitch);
         break;
         default:
             ERRX("ilImage_star(): wrong image type");
@@ -179,6 +263,28 @@ il_Image *il_Image_star(il_imtype_t type, int w, int h, double fwhm, double beta
 }
 #undef DRAW_star
 
+// find output (image) and input (pattern) limit coordinates to put pattern `p` centered at (xc,yc)
+// onto image RxD; return FALSE if pattern is outside of image
+static int pattern_clip(int R, int D, const il_Pattern *p, int xc, int yc, int *oxlow, int *oxhigh,
+                        int *oylow, int *oyhigh, int *ixlow, int *iylow){
+    int xul = xc - p->width/2, yul = yc - p->height/2;
+    int xdr = xul+p->width-1, ydr = yul+p->height-1;
+    if(ydr < 0 || xdr < 0 || xul > R-1 || yul > D-1) return FALSE; // box outside of image
+    if(xul < 0){
+        *oxlow = 0; *ixlow = -xul;
+    }else{
+        *oxlow = xul; *ixlow = 0;
+    }
+    if(yul < 0){
+        *oylow = 0; *iylow = -yul;
+    }else{
+        *oylow = yul; *iylow = 0;
+    }
+    *oxhigh = (xdr < R) ? xdr : R;
+    *oyhigh = (ydr < D) ? ydr : D;
+    return TRUE;
+}
+
 /**
  * @brief il_Img3_drawpattern - draw pattern @ 3-channel image
  * @param img (io)    - image
@@ -188,37 +294,12 @@ il_Image *il_Image_star(il_imtype_t type, int w, int h, double fwhm, double beta
  */
 void il_Img3_drawpattern(il_Img3 *img, const il_Pattern *p, int xc, int yc, const uint8_t color[3]){
     if(!img || !p) return;
-    int xul = xc - p->width/2, yul = yc - p->height/2;
-    int xdr = xul+p->width-1, ydr = yul+p->height-1;
-    int R = img->width, D = img->height; // right and down border coordinates + 1
-    if(ydr < 0 || xdr < 0 || xul > R-1 || yul > D-1) return; // box outside of image
-
-    int oxlow, oxhigh, oylow, oyhigh; // output limit coordinates
-    int ixlow, iylow; // intput limit coordinates
-    if(xul < 0){
-        oxlow = 0; ixlow = -xul;
-    }else{
-        oxlow = xul; ixlow = 0;
-    }
-    if(yul < 0){
-        oylow = 0; iylow = -yul;
-    }else{
-        oylow = yul; iylow = 0;
-    }
-    if(xdr < R){
-        oxhigh = xdr;
-    }else{
-        oxhigh = R;
-    }
-    if(ydr < D){
-        oyhigh = ydr;
-    }else{
-        oyhigh = D;
-    }
+    int oxlow, oxhigh, oylow, oyhigh, ixlow, iylow;
+    if(!pattern_clip(img->width, img->height, p, xc, yc, &oxlow, &oxhigh, &oylow, &oyhigh, &ixlow, &iylow)) return;
     OMP_FOR()
     for(int y = oylow; y < oyhigh; ++y){
         uint8_t *in = &p->data[(iylow+y-oylow)*p->width + ixlow]; // opaque component
-        uint8_t *out = &img->data[(y*img->width + oxlow)*3]; // 3-colours
+        uint8_t *out = &img->data[((size_t)y*img->width + oxlow)*3]; // 3-colours
         for(int x = oxlow; x < oxhigh; ++x, ++in, out += 3){
             float opaque = ((float)*in)/255.;
             for(int c = 0; c < 3; ++c){
@@ -228,11 +309,31 @@ void il_Img3_drawpattern(il_Img3 *img, const il_Pattern *p, int xc, int yc, cons
     }
 }
 
+// the same as il_Img3_drawpattern but for planar image
+void il_Img3p_drawpattern(il_Img3p *img, const il_Pattern *p, int xc, int yc, const uint8_t color[3]){
+    if(!img || !p) return;
+    int oxlow, oxhigh, oylow, oyhigh, ixlow, iylow;
+    if(!pattern_clip(img->width, img->height, p, xc, yc, &oxlow, &oxhigh, &oylow, &oyhigh, &ixlow, &iylow)) return;
+    int len = oxhigh - oxlow;
+    OMP_FOR()
+    for(int y = oylow; y < oyhigh; ++y){
+        const uint8_t *restrict in = &p->data[(iylow+y-oylow)*p->width + ixlow]; // opaque component
+        for(int c = 0; c < 3; ++c){ // one colour plane at a time: vectorized by compiler
+            uint8_t *restrict out = img->plane[c] + (size_t)y*img->width + oxlow;
+            uint8_t col = color[c];
+            for(int x = 0; x < len; ++x){
+                float opaque = ((float)in[x])/255.;
+                out[x] = (uint8_t)(col * opaque + out[x]*(1.-opaque));
+            }
+        }
+    }
+}
+
 #define ADD_subim(type, max) \
     OMP_FOR() \
     for(int y = oylow; y < oyhigh; ++y){ \
-        type *in = &((type*)(p->data))[(iylow+y-oylow)*p->width + ixlow];  \
-        type *out = &((type*)(img->data))[y*img->width + oxlow];  \
+        type *in = IL_ROW(type, p, iylow+y-oylow) + ixlow;  \
+        type *out = IL_ROW(type, img, y) + oxlow;  \
         for(int x = oxlow; x < oxhigh; ++x, ++in, ++out){ \
             double res = *in * weight + *out; \
             if(max && res > max) res = max; \
@@ -299,10 +400,11 @@ void il_Image_addsub(il_Image *img, const il_Image *p, int xc, int yc, double we
         default:
             ERRX("iladd_subimage(): wrong image type");
     }
+    il_Image_modified(img);
 }
 #undef ADD_subim
 
-#define PUTP(type) do{((type*)I->data)[I->width*y+x] = *((type*)val);}while(0)
+#define PUTP(type) do{IL_ROW(type, I, y)[x] = *((type*)val);}while(0)
 /**
  * @brief il_Image_drawpix - put pixel @(x,y)
  * @param I - image
@@ -331,6 +433,7 @@ void il_Image_drawpix(il_Image *I, int x, int y, const void *val){
         default:
             ERRX("ilImage_drawpix(): wrong image type");
     }
+    il_Image_modified(I);
 }
 #undef PUTP
 
@@ -442,7 +545,28 @@ void il_Img3_drawpix(il_Img3 *I, int x, int y, const uint8_t color[3]){
     if(!I || !I->data) return;
     if(x < 0 || x >= I->width) return;
     if(y < 0 || y >= I->height) return;
-    il_Img3_setcolor(I->data + 3*(I->width*y+x), color);
+    il_Img3_setcolor(I->data + 3*((size_t)I->width*y+x), color);
+}
+
+/**
+ * @brief il_Img3p_setcolor - the same as il_Img3_setcolor but for pixel `idx` (=x+y*width) of planar image
+ * @param I - image
+ * @param idx - pixel index
+ * @param color - desired color
+ */
+void il_Img3p_setcolor(il_Img3p *I, size_t idx, const uint8_t color[3]){
+    uint8_t pix[3];
+    for(int c = 0; c < 3; ++c) pix[c] = I->plane[c][idx];
+    il_Img3_setcolor(pix, color);
+    for(int c = 0; c < 3; ++c) I->plane[c][idx] = pix[c];
+}
+
+// the same as il_Img3_drawpix but for planar image
+void il_Img3p_drawpix(il_Img3p *I, int x, int y, const uint8_t color[3]){
+    if(!I || !I->data) return;
+    if(x < 0 || x >= I->width) return;
+    if(y < 0 || y >= I->height) return;
+    il_Img3p_setcolor(I, (size_t)I->width*y + x, color);
 }
 
 // draw lines across X or Y axis over color image
@@ -532,7 +656,7 @@ void il_Img3_drawcircle(il_Img3 *I, int x0, int y0, int R, const uint8_t color[3
 
 static void drawhline(il_Img3 *img, int y, const uint8_t color[3], int dots){
     if(y < 0 || y >= img->height) return;
-    uint8_t *data = img->data + 3*y*img->width;
+    uint8_t *data = img->data + 3*(size_t)y*img->width;
     for(int x = 0; x < img->width; ++x, data += 3){
         if(dots && (x % DOTSTEP)) continue;
         il_Img3_setcolor(data, color);
@@ -541,7 +665,7 @@ static void drawhline(il_Img3 *img, int y, const uint8_t color[3], int dots){
 static void drawvline(il_Img3 *img, int x, const uint8_t color[3], int dots){
     if(x < 0 || x >= img->width) return;
     uint8_t *data = img->data + 3*x;
-    int step = 3*img->width;
+    size_t step = 3*(size_t)img->width;
     for(int y = 0; y < img->height; ++y, data += step){
         if(dots && (y % DOTSTEP)) continue;
         il_Img3_setcolor(data, color);
@@ -610,8 +734,8 @@ il_Img3 *il_Img3_subimage(const il_Img3 *I, int x0, int y0, int x1, int y1){
     DBG("output subimage: from (%d, %d) to (%d, %d)", oxl,oyt, oxl + ixr - ixl, oyt + iyb - iyt);
     OMP_FOR()
     for(int y = 0; y < ypix; ++y){
-        uint8_t *in = I->data + (ixl + (iyt + y)*I->width)*3;
-        uint8_t *out = O->data + (oxl + (oyt + y)*O->width)*3;
+        uint8_t *in = I->data + (ixl + (size_t)(iyt + y)*I->width)*3;
+        uint8_t *out = O->data + (oxl + (size_t)(oyt + y)*O->width)*3;
         memcpy(out, in, xlen);
     }
     return O;
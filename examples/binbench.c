@@ -0,0 +1,90 @@
+/*
+ * This file is part of the improclib project.
+ * Copyright 2023 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// benchmark of il_Image2bin against simple serial pixel-by-pixel binarization
+
+#include "improclib.h"
+#include <usefull_macros.h>
+#include <stdio.h>
+#include <string.h>
+
+static int w = 8192, h = 8192, niter = 20, help = 0;
+static double bk = 127.5;
+
+static myoption cmdlnopts[] = {
+    {"help",    NO_ARGS,    NULL,   '?',    arg_int,    APTR(&help),    "show this help"},
+    {"width",   NEED_ARG,   NULL,   'w',    arg_int,    APTR(&w),       "image width (default: 8192)"},
+    {"height",  NEED_ARG,   NULL,   'h',    arg_int,    APTR(&h),       "image height (default: 8192)"},
+    {"niter",   NEED_ARG,   NULL,   'n',    arg_int,    APTR(&niter),   "amount of iterations (default: 20)"},
+    {"bk",      NEED_ARG,   NULL,   'b',    arg_double, APTR(&bk),      "binarization threshold (default: 127.5)"},
+    end_option
+};
+
+// reference: compare each pixel with double threshold and shift it into word
+static void simplebin(const il_Image *im, double thres, il_BinImage *out){
+    int W = im->width, H = im->height;
+    for(int y = 0; y < H; ++y){
+        uint8_t *iptr = IL_ROW(uint8_t, im, y);
+        uint64_t *optr = IL_BINROW(out, y);
+        for(int x = 0; x < W; x += 64){
+            int n = (W - x < 64) ? W - x : 64;
+            uint64_t o = 0;
+            for(int i = 0; i < n; ++i){
+                o <<= 1;
+                if(*iptr++ > thres) o |= 1;
+            }
+            *optr++ = o << (64 - n);
+        }
+    }
+}
+
+int main(int argc, char **argv){
+    initial_setup();
+    parseargs(&argc, &argv, cmdlnopts);
+    if(help) showhelp(-1, cmdlnopts);
+    if(w < 2 || h < 2 || niter < 1) ERRX("Wrong parameters");
+    il_Image *I = il_Image_new(w, h, IMTYPE_U8);
+    if(!I) ERRX("Can't create image %dx%d pixels", w, h);
+    for(int y = 0; y < h; ++y){
+        uint8_t *row = IL_ROW(uint8_t, I, y);
+        for(int x = 0; x < w; ++x) row[x] = (uint8_t)(lrand48() & 0xff);
+    }
+    double GB = (double)w * h * niter / 1e9; // input bytes processed
+    il_BinImage *ref = il_BinImage_new(w, h);
+    double t0 = dtime();
+    for(int i = 0; i < niter; ++i) simplebin(I, bk, ref);
+    double tref = dtime() - t0;
+    green("Serial:   %8.2fms per frame, %6.2f GB/s\n", 1e3*tref/niter, GB/tref);
+    il_ImagePool *pool = il_ImagePool_new(2);
+    il_BinImage *B = NULL;
+    t0 = dtime();
+    for(int i = 0; i < niter; ++i){
+        il_BinImage_free(&B);
+        B = il_Image2binP(pool, I, bk);
+    }
+    double tnew = dtime() - t0;
+    green("Image2bin:%8.2fms per frame, %6.2f GB/s (x%.1f)\n", 1e3*tnew/niter, GB/tnew, tref/tnew);
+    int nw = (w + 63) / 64;
+    for(int y = 0; y < h; ++y)
+        if(memcmp(IL_BINROW(ref, y), IL_BINROW(B, y), nw*sizeof(uint64_t))) ERRX("Results differ at row %d", y);
+    il_BinImage_free(&B);
+    il_BinImage_free(&ref);
+    il_ImagePool_free(&pool);
+    il_Image_free(&I);
+    return 0;
+}
@@ -52,11 +52,11 @@ int main(int argc, char **argv){
         double x, y;
         il_NormalPair(&x, &y, x0, y0, xsigma, ysigma);
         if(x < 0 || x >= I->width || y < 0 || y >= I->height) continue;
-        uint8_t *pix = I->data + (int)x + ((int)y)*I->width;
+        uint8_t *pix = IL_ROW(uint8_t, I, (int)y) + (int)x;
         if(*pix < 255) ++*pix;
         ++hits;
     }
-    int ret = il_write_png(outp, I->width, I->height, 1, I->data);
+    int ret = il_Image_png(outp, I);
     il_Image_free(&I);
     if(!ret) return 1;
     printf("File %s ready; %d hits of %d\n", outp, hits, Niter);
@@ -20,12 +20,13 @@
 
 #include "improclib.h"
 #include <usefull_macros.h>
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
 
-static int help = 0, ndilat = 0, neros = 0;
-double bg = -1.;
-static char *infile = NULL, *outbg = NULL, *outbin = NULL;
+static int help = 0, ndilat = 0, neros = 0, radius = 0;
+double bg = -1., adaptk = NAN;
+static char *infile = NULL, *outbg = NULL, *outbin = NULL, *adapt = NULL;
 
 static myoption cmdlnopts[] = {
     {"help",    NO_ARGS,    NULL,   'h',    arg_int,    APTR(&help),    "show this help"},
@@ -35,6 +36,9 @@ static myoption cmdlnopts[] = {
     {"obin",    NEED_ARG,   NULL,   0,      arg_string, APTR(&outbin),  "--obg after binarizing"},
     {"ndilat",  NEED_ARG,   NULL,   'd',    arg_int,    APTR(&ndilat),  "amount of dilations after erosions"},
     {"neros",   NEED_ARG,   NULL,   'e',    arg_int,    APTR(&neros),   "amount of image erosions"},
+    {"adaptive",NEED_ARG,   NULL,   'a',    arg_string, APTR(&adapt),   "binarize by local threshold: mean, niblack or sauvola"},
+    {"radius",  NEED_ARG,   NULL,   'r',    arg_int,    APTR(&radius),  "radius of local threshold window (default: 15)"},
+    {"adaptk",  NEED_ARG,   NULL,   'k',    arg_double, APTR(&adaptk),  "parameter k of local threshold (in data units for mean, required; niblack: 3, sauvola: -0.2)"},
     end_option
 };
 
@@ -45,41 +49,66 @@ int main(int argc, char **argv){
     if(!infile) ERRX("Point name of input file");
     il_Image *I = il_Image_read(infile);
     if(!I) ERR("Can't read %s", infile);
-    if(bg < 0. && !il_Image_background(I, &bg)) ERRX("Can't calculate background");
-    uint8_t ibg = (int)(bg + 0.5);
-    printf("Background level: %d\n", ibg);
-    int w = I->width, h = I->height, wh = w*h;
-    il_Image *Ibg = il_Image_sim(I);
-    memcpy(Ibg->data, I->data, wh);
-    uint8_t *idata = (uint8_t*) Ibg->data;
-    for(int i = 0; i < wh; ++i) idata[i] = (idata[i] > ibg) ? idata[i] - ibg : 0;
-    if(outbg) il_write_jpg(outbg, Ibg->width, Ibg->height, 1, idata, 95);
+    il_adapt_t method = IL_ADAPT_AMOUNT;
+    if(adapt){
+        if(strcmp(adapt, "mean") == 0) method = IL_ADAPT_MEAN;
+        else if(strcmp(adapt, "niblack") == 0) method = IL_ADAPT_NIBLACK;
+        else if(strcmp(adapt, "sauvola") == 0) method = IL_ADAPT_SAUVOLA;
+        else ERRX("Wrong local threshold method: %s", adapt);
+        if(isnan(adaptk)) switch(method){ // defaults for bright objects on dark background
+            case IL_ADAPT_NIBLACK:
+                adaptk = 3.;
+            break;
+            case IL_ADAPT_SAUVOLA:
+                adaptk = -0.2;
+            break;
+            default:
+                ERRX("Point parameter k (-k) for local mean threshold");
+        }
+    }
+    if(method == IL_ADAPT_AMOUNT || outbg){ // background is needed only for global threshold and --obg
+        if(bg < 0. && !il_Image_background(I, &bg)) ERRX("Can't calculate background");
+        uint8_t ibg = (int)(bg + 0.5);
+        printf("Background level: %d\n", ibg);
+        if(outbg){
+            int w = I->width, h = I->height;
+            uint8_t *idata = MALLOC(uint8_t, w*h), *optr = idata;
+            for(int y = 0; y < h; ++y){
+                uint8_t *iptr = IL_ROW(uint8_t, I, y);
+                for(int x = 0; x < w; ++x, ++iptr) *optr++ = (*iptr > ibg) ? *iptr - ibg : 0;
+            }
+            il_write_jpg(outbg, w, h, 1, idata, 95);
+            FREE(idata);
+        }
+    }
     double t0 = dtime();
-    uint8_t *Ibin = il_Image2bin(I, bg);
+    il_BinImage *Ibin = (method == IL_ADAPT_AMOUNT) ? il_Image2bin(I, bg) : il_Image2binAdapt(I, method, radius, adaptk, 0.);
     if(!Ibin) ERRX("Can't binarize image");
     green("Binarization: %gms\n", 1e3*(dtime()-t0));
     if(neros > 0){
         t0 = dtime();
-        uint8_t *eros = il_erosionN(Ibin, w, h, neros);
-        FREE(Ibin);
+        il_BinImage *eros = il_erosionN(Ibin, neros);
+        il_BinImage_free(&Ibin);
         Ibin = eros;
         green("%d erosions: %gms\n", neros, 1e3*(dtime()-t0));
     }
     if(ndilat > 0){
         t0 = dtime();
-        uint8_t *dilat = il_dilationN(Ibin, w, h, ndilat);
-        FREE(Ibin);
+        il_BinImage *dilat = il_dilationN(Ibin, ndilat);
+        il_BinImage_free(&Ibin);
         Ibin = dilat;
         green("%d dilations: %gms\n", ndilat, 1e3*(dtime()-t0));
     }
     if(outbin){
-        il_Image *tmp = il_bin2Image(Ibin, w, h);
-        il_write_jpg(outbin, tmp->width, tmp->height, 1, (uint8_t*)tmp->data, 95);
+        il_Image *tmp = il_bin2Image(Ibin);
+        uint8_t *bytes = il_Image2u8(tmp, 1);
+        il_write_jpg(outbin, tmp->width, tmp->height, 1, bytes, 95);
+        FREE(bytes);
         il_Image_free(&tmp);
     }
     il_ConnComps *comps;
     t0 = dtime();
-    size_t *labels = il_CClabel4(Ibin, w, h, &comps);
+    size_t *labels = il_CClabel4(Ibin, &comps);
     green("Labeling: %gms\n", 1e3*(dtime()-t0));
     if(labels && comps->Nobj > 1){
         printf("Detected %zd components\n", comps->Nobj-1);
@@ -41,13 +41,14 @@ int main(int argc, char **argv){
     if(lambda < 1.) ERRX("LAMBDA should be >=1");
     il_Image *I = il_Image_new(w, h, IMTYPE_U8);
     if(!I) ERRX("Can't create image %dx%d pixels", w, h);
-    int npix = I->height * I->width;
-    uint8_t *d = I->data;
-    for(int i = 0; i < npix; ++i, ++d){
-        int ampl = il_Poisson(lambda);
-        *d = ampl < 255 ? ampl : 255;
+    for(int y = 0; y < I->height; ++y){
+        uint8_t *d = IL_ROW(uint8_t, I, y);
+        for(int x = 0; x < I->width; ++x, ++d){
+            int ampl = il_Poisson(lambda);
+            *d = ampl < 255 ? ampl : 255;
+        }
     }
-    int ret = il_write_png(outp, I->width, I->height, 1, I->data);
+    int ret = il_Image_png(outp, I);
     il_Image_free(&I);
     if(!ret) return 1;
     printf("File %s ready\n", outp);
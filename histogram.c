@@ -0,0 +1,771 @@
+/*
+ * This file is part of the improclib project.
+ * Copyright 2023 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Histogram engine: each thread counts its rows into own heap-allocated 32-bit bins (split into several
+ * sub-histograms: neighbouring pixels with the same value don't wait for each other's increments), then
+ * all threads sum their slices of bins over all private histograms into 64-bit result. To keep 32-bit
+ * counters from overflow, image is processed by chunks of less than 2^31 pixels.
+ */
+
+#include <usefull_macros.h>
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+
+#include "improclib.h"
+#include "openmp.h"
+
+// amount of sub-histograms for U8, U16 and U32/F/D images (the last two are limited by L2 cache size)
+#define NSUB8       (4)
+#define NSUB16      (2)
+#define NSUBW       (2)
+// default amount of bins for U32/F/D images
+#define NBINSW      (65536)
+// U32/F/D: bin numbers are calculated (vectorized) by blocks of this amount of pixels, then counted
+#define HBLOCK      (256)
+
+// binning parameters for U32/F/D images
+typedef struct{
+    double min;         // range
+    double max;
+    double k;           // nbins / (max - min)
+    int nbins;          // amount of bins; extra bins: nbins - under, nbins+1 - over, nbins+2 - NaN
+                        // (for keys: nbins - out of range or NaN)
+    uint64_t kmin;      // histogram of keys: bin is (key - kmin) >> shift for keys in [kmin, kmin + krange]
+    uint64_t krange;
+    int shift;
+    double center;      // keys of absolute deviations: deviations from this value
+} hpar;
+
+// count pixels of row `in` into `nsub` sub-histograms of `nb` bins each
+typedef void (*hcounter)(const void *in, int w, uint32_t *h, int nb, const hpar *par);
+
+static void count_u8(const void *in, int w, uint32_t *h, int nb, const hpar *par){
+    (void)par;
+    const uint8_t *p = (const uint8_t*)in;
+    uint32_t *h0 = h, *h1 = h + nb, *h2 = h + 2*nb, *h3 = h + 3*nb;
+    int x = 0;
+    for(; x + 4 <= w; x += 4){
+        ++h0[p[x]]; ++h1[p[x+1]]; ++h2[p[x+2]]; ++h3[p[x+3]];
+    }
+    for(; x < w; ++x) ++h0[p[x]];
+}
+
+static void count_u16(const void *in, int w, uint32_t *h, int nb, const hpar *par){
+    (void)par;
+    const uint16_t *p = (const uint16_t*)in;
+    uint32_t *h0 = h, *h1 = h + nb;
+    int x = 0;
+    for(; x + 2 <= w; x += 2){
+        ++h0[p[x]]; ++h1[p[x+1]];
+    }
+    for(; x < w; ++x) ++h0[p[x]];
+}
+
+// count block of bin numbers into NSUBW sub-histograms
+static inline void count_idx(const uint32_t *idx, int n, uint32_t *h, int nb){
+    uint32_t *h0 = h, *h1 = h + nb;
+    int i = 0;
+    for(; i + 2 <= n; i += 2){
+        ++h0[idx[i]]; ++h1[idx[i+1]];
+    }
+    if(i < n) ++h0[idx[i]];
+}
+
+#define COUNTW(type) \
+static void count_##type(const void *in, int w, uint32_t *h, int nb, const hpar *par){ \
+    const type *p = (const type*)in; \
+    const double min = par->min, max = par->max, k = par->k, last = par->nbins - 1; \
+    const uint32_t under = par->nbins, over = par->nbins + 1, nan = par->nbins + 2; \
+    uint32_t idx[HBLOCK]; \
+    for(int x0 = 0; x0 < w; x0 += HBLOCK){ \
+        int n = (w - x0 < HBLOCK) ? w - x0 : HBLOCK; \
+        for(int i = 0; i < n; ++i){ \
+            double v = (double)p[x0 + i], t = (v - min) * k; \
+            t = (t > 0.) ? ((t < last) ? t : last) : 0.; \
+            uint32_t b = (uint32_t)(int32_t)t; \
+            b = (v < min) ? under : b; \
+            b = (v > max) ? over : b; \
+            idx[i] = (v == v) ? b : nan; \
+        } \
+        count_idx(idx, n, h, nb); \
+    } \
+}
+COUNTW(uint32_t)
+COUNTW(float)
+COUNTW(double)
+#undef COUNTW
+
+// source of rows for histogram engine: row `r` (0 <= r < nrows) of `src` and its width `*w` (<= maxw)
+typedef const uint8_t *(*hrow)(const void *src, int r, int *w);
+typedef struct{
+    const void *src;
+    hrow row;
+    int nrows;
+    int maxw;
+} hsrc;
+
+static const uint8_t *image_row(const void *src, int r, int *w){
+    const il_Image *I = (const il_Image*)src;
+    *w = I->width;
+    return IL_ROW(uint8_t, I, r);
+}
+
+// tiled image: rows of full frame are split into tile segments, r = y*ntx + tx
+static const uint8_t *tile_row(const void *src, int r, int *w){
+    const il_TiledImage *T = (const il_TiledImage*)src;
+    int ts = T->tilesize, tx = r % T->ntx, y = r / T->ntx, x0 = tx * ts;
+    *w = (T->width - x0 < ts) ? T->width - x0 : ts;
+    size_t n = (size_t)(y / ts) * T->ntx + tx; // tile number; tile rows have pitch ts*pixbytes
+    return (const uint8_t*)T->data + n * T->tilebytes + (size_t)(y % ts) * ts * T->pixbytes;
+}
+
+/**
+ * @brief histo_rows - count all pixels of rows source into histogram
+ * @param S - rows source
+ * @param count - row counter
+ * @param nb - amount of bins
+ * @param nsub - amount of sub-histograms used by `count`
+ * @param par - parameters for `count`
+ * @param histogram (o) - array of `nb` bins (zeroed here)
+ */
+static void histo_rows(const hsrc *S, hcounter count, int nb, int nsub, const hpar *par, size_t *histogram){
+    int h = S->nrows;
+    int chunk = INT_MAX / S->maxw; // rows per chunk: less than 2^31 pixels
+    size_t privsz = (size_t)nsub * nb;
+    uint32_t **priv = MALLOC(uint32_t*, OMP_MAX_THREADS());
+    memset(histogram, 0, nb * sizeof(size_t));
+#pragma omp parallel
+{
+    int id = OMP_THREAD_NUM(), nt = OMP_NUM_THREADS();
+    uint32_t *my = priv[id] = MALLOC(uint32_t, privsz);
+    // slice of bins merged by this thread
+    int b0 = (int)((size_t)nb * id / nt), b1 = (int)((size_t)nb * (id + 1) / nt);
+    for(int y0 = 0; y0 < h; y0 += chunk){
+        int y1 = (h - y0 > chunk) ? y0 + chunk : h;
+        #pragma omp for schedule(static)
+        for(int y = y0; y < y1; ++y){
+            int w;
+            const uint8_t *in = S->row(S->src, y, &w);
+            count(in, w, my, nb, par);
+        }
+        // implicit barrier: all private histograms are ready
+        for(int t = 0; t < nt; ++t){
+            const uint32_t *src = priv[t];
+            for(int s = 0; s < nsub; ++s, src += nb)
+                for(int b = b0; b < b1; ++b) histogram[b] += src[b];
+        }
+        #pragma omp barrier
+        if(y1 < h) memset(my, 0, privsz * sizeof(uint32_t));
+    }
+    FREE(my);
+}
+    FREE(priv);
+}
+
+// count all pixels of image into histogram (see histo_rows)
+static void histo_engine(const il_Image *I, hcounter count, int nb, int nsub, const hpar *par, size_t *histogram){
+    hsrc S = {.src = I, .row = image_row, .nrows = I->height, .maxw = I->width};
+    histo_rows(&S, count, nb, nsub, par, histogram);
+}
+
+/**
+ * @brief il_TiledImage_histogram - calculate histogram of U8 or U16 tiled image
+ * @param T - image
+ * @return allocated here array of 256 (U8) or 65536 (U16) bins or NULL if error
+ */
+size_t *il_TiledImage_histogram(const il_TiledImage *T){
+    if(!T || !T->data) return NULL;
+    if(T->type != IMTYPE_U8 && T->type != IMTYPE_U16){
+        WARNX("il_TiledImage_histogram(): supported only 8- and 16-bit images");
+        return NULL;
+    }
+    if((size_t)T->ntx * T->height > INT_MAX){
+        WARNX("il_TiledImage_histogram(): image is too large");
+        return NULL;
+    }
+    hsrc S = {.src = T, .row = tile_row, .nrows = T->ntx * T->height, .maxw = T->tilesize};
+    int nbins = (T->type == IMTYPE_U8) ? 256 : 65536;
+    size_t *histogram = MALLOC(size_t, nbins);
+    if(nbins == 256) histo_rows(&S, count_u8, 256, NSUB8, NULL, histogram);
+    else histo_rows(&S, count_u16, 65536, NSUB16, NULL, histogram);
+    return histogram;
+}
+
+/**
+ * @brief rebin - fill histogram `H` by histogram `nat` of all values 0..nvals-1 of integer image
+ */
+static void rebin(const size_t *nat, int nvals, il_Histogram *H){
+    int nbins = H->nbins;
+    double min = H->min, max = H->max, k = nbins / (max - min);
+    memset(H->bins, 0, nbins * sizeof(size_t));
+    H->under = H->over = 0;
+    for(int v = 0; v < nvals; ++v){
+        if(!nat[v]) continue;
+        if(v < min) H->under += nat[v];
+        else if(v > max) H->over += nat[v];
+        else{
+            int b = (int)((v - min) * k);
+            H->bins[(b < nbins) ? b : nbins - 1] += nat[v];
+        }
+    }
+}
+
+// U32/F/D: count into nbins + 3 bins (see hpar)
+static int fill_wide(il_Histogram *H, const il_Image *I){
+    hcounter count;
+    switch(I->type){
+        case IMTYPE_U32:
+            count = count_uint32_t;
+        break;
+        case IMTYPE_F:
+            count = count_float;
+        break;
+        case IMTYPE_D:
+            count = count_double;
+        break;
+        default:
+            WARNX("il_Histogram_fill(): unsupported image type %d", I->type);
+            return FALSE;
+    }
+    int nbins = H->nbins;
+    hpar par = {.min = H->min, .max = H->max, .k = nbins / (H->max - H->min), .nbins = nbins};
+    size_t *all = MALLOC(size_t, nbins + 3);
+    histo_engine(I, count, nbins + 3, NSUBW, &par, all);
+    memcpy(H->bins, all, nbins * sizeof(size_t));
+    H->under = all[nbins];
+    H->over = all[nbins + 1];
+    FREE(all);
+    return TRUE;
+}
+
+/**
+ * @brief il_Histogram_fill - calculate histogram of image into prepared structure (by one pass over data)
+ * @param H - histogram with nbins > 0, min < max and allocated `bins`
+ * @param I - image (NaNs aren't counted)
+ * @return FALSE if error
+ */
+int il_Histogram_fill(il_Histogram *H, const il_Image *I){
+    if(!H || !H->bins || H->nbins < 1 || !(H->max > H->min) || !I || !I->data) return FALSE;
+    int nvals;
+    hcounter count;
+    int nsub;
+    switch(I->type){
+        case IMTYPE_U8:
+            nvals = 256; count = count_u8; nsub = NSUB8;
+        break;
+        case IMTYPE_U16:
+            nvals = 65536; count = count_u16; nsub = NSUB16;
+        break;
+        default:
+            return fill_wide(H, I);
+    }
+    if(H->nbins == nvals && H->min == 0. && H->max == (double)nvals){ // bin is value
+        histo_engine(I, count, nvals, nsub, NULL, H->bins);
+        H->under = H->over = 0;
+        return TRUE;
+    }
+    size_t *nat = MALLOC(size_t, nvals);
+    histo_engine(I, count, nvals, nsub, NULL, nat);
+    rebin(nat, nvals, H);
+    FREE(nat);
+    return TRUE;
+}
+
+static il_Histogram *histo_new(const il_Image *I, int nbins, double min, double max){
+    il_Histogram *H = MALLOC(il_Histogram, 1);
+    H->nbins = nbins;
+    H->min = min;
+    H->max = max;
+    H->bins = MALLOC(size_t, nbins);
+    if(!il_Histogram_fill(H, I)) il_Histogram_free(&H);
+    return H;
+}
+
+// range of image values from (cached) statistics; flat image gets range of width 1
+static void image_range(const il_Image *I, double *min, double *max){
+    il_Image_minmax((il_Image*)I); // cache is the only thing we could change here
+    *min = I->minval;
+    *max = (I->maxval > I->minval) ? I->maxval : I->minval + 1.;
+}
+
+/**
+ * @brief il_Image_histogram - calculate histogram with `nbins` equal bins over [min, max]
+ *          (bin `i` is [min + i*d, min + (i+1)*d), the last bin includes `max`)
+ * @param I - image
+ * @param nbins - amount of bins (0 - default: one bin per value for U8 (256 bins) and U16 (65536 bins),
+ *          also for U32 with less than 65536 different values; 65536 bins for others)
+ * @param min, max - range (if min >= max - [0, 256] for U8, [0, 65536] for U16, [minval, maxval] for others)
+ * @return histogram allocated here (free it by il_Histogram_free()) or NULL if error
+ */
+il_Histogram *il_Image_histogram(const il_Image *I, int nbins, double min, double max){
+    if(!I || !I->data || I->type >= IMTYPE_AMOUNT) return NULL;
+    if(I->type == IMTYPE_U8 || I->type == IMTYPE_U16){
+        int nvals = (I->type == IMTYPE_U8) ? 256 : 65536;
+        if(nbins < 1) nbins = nvals;
+        if(min >= max){
+            min = 0.;
+            max = (double)nvals;
+        }
+        return histo_new(I, nbins, min, max);
+    }
+    if(min >= max) image_range(I, &min, &max);
+    if(nbins < 1){
+        if(I->type == IMTYPE_U32 && max - min < NBINSW){ // one bin per value
+            nbins = (int)(max - min) + 1;
+            max = min + nbins;
+        }else nbins = NBINSW;
+    }
+    return histo_new(I, nbins, min, max);
+}
+
+/**
+ * @brief il_Image_histogramW - the same as il_Image_histogram but with given bin width
+ * @param I - image
+ * @param binw - bin width (> 0)
+ * @param min, max - range (if min >= max - [minval, maxval]); `max` is increased to integer amount of bins
+ * @return histogram allocated here or NULL if error
+ */
+il_Histogram *il_Image_histogramW(const il_Image *I, double binw, double min, double max){
+    if(!I || !I->data || I->type >= IMTYPE_AMOUNT || !(binw > 0.)) return NULL;
+    if(min >= max) image_range(I, &min, &max);
+    double n = ceil((max - min) / binw);
+    if(n < 1.) n = 1.;
+    if(n > INT_MAX){
+        WARNX("il_Image_histogramW(): too many bins");
+        return NULL;
+    }
+    return histo_new(I, (int)n, min, min + n * binw);
+}
+
+void il_Histogram_free(il_Histogram **H){
+    if(!H || !*H) return;
+    FREE((*H)->bins);
+    FREE(*H);
+}
+
+/*
+ * Order statistics (percentiles, median, MAD). U8/U16: walk over cumulative histogram of values. U32/F/D: values
+ * are mapped to integer keys with the same order, histogram of keys in [key(min), key(max)] (shifted right to fit
+ * in NBINSW bins) gives bins containing needed ranks; values from these bins are gathered and selected by
+ * quickselect (by qsort if partitioning goes bad).
+ */
+
+static inline uint64_t key_uint32_t(uint32_t v){ return v; }
+static inline uint64_t key_float(float v){
+    uint32_t u;
+    memcpy(&u, &v, sizeof(u));
+    return (u & 0x80000000u) ? (uint32_t)~u : (u | 0x80000000u);
+}
+static inline uint64_t key_double(double v){
+    uint64_t u;
+    memcpy(&u, &v, sizeof(u));
+    return (u >> 63) ? ~u : (u | (1ULL << 63));
+}
+static inline double unkey_uint32_t(uint64_t k){ return (double)k; }
+static inline double unkey_float(uint64_t k){
+    uint32_t u = (k & 0x80000000u) ? (uint32_t)k & 0x7fffffffu : ~(uint32_t)k;
+    float v;
+    memcpy(&v, &u, sizeof(v));
+    return v;
+}
+static inline double unkey_double(uint64_t k){
+    uint64_t u = (k >> 63) ? k & ~(1ULL << 63) : ~k;
+    double v;
+    memcpy(&v, &u, sizeof(v));
+    return v;
+}
+
+// value used for key: pixel itself or its absolute deviation from `center`
+#define PIXVAL(v)   (v)
+#define DEVVAL(v)   fabs((double)(v) - center)
+
+// keys of `val` of pixels of `type`, `ktype` is type of value
+#define COUNTK(name, type, ktype, val) \
+static void name(const void *in, int w, uint32_t *h, int nb, const hpar *par){ \
+    const type *p = (const type*)in; \
+    const uint64_t kmin = par->kmin, krange = par->krange; \
+    const int shift = par->shift; \
+    const uint32_t out = par->nbins; \
+    const double center = par->center; \
+    (void)center; \
+    uint32_t idx[HBLOCK]; \
+    for(int x0 = 0; x0 < w; x0 += HBLOCK){ \
+        int n = (w - x0 < HBLOCK) ? w - x0 : HBLOCK; \
+        for(int i = 0; i < n; ++i){ \
+            uint64_t d = key_##ktype(val(p[x0 + i])) - kmin; \
+            idx[i] = (d <= krange) ? (uint32_t)(d >> shift) : out; \
+        } \
+        count_idx(idx, n, h, nb); \
+    } \
+}
+COUNTK(countk_uint32_t, uint32_t, uint32_t, PIXVAL)
+COUNTK(countk_float, float, float, PIXVAL)
+COUNTK(countk_double, double, double, PIXVAL)
+COUNTK(countd_uint32_t, uint32_t, double, DEVVAL)
+COUNTK(countd_float, float, double, DEVVAL)
+COUNTK(countd_double, double, double, DEVVAL)
+#undef COUNTK
+
+static int cmpdbl(const void *a, const void *b){
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static int cmpsz(const void *a, const void *b){
+    size_t x = *(const size_t*)a, y = *(const size_t*)b;
+    return (x > y) - (x < y);
+}
+
+#define DSWAP(i, j) do{double t_ = a[i]; a[i] = a[j]; a[j] = t_;}while(0)
+/**
+ * @brief il_qselect - k-th smallest value of array (it's reordered: values left of a[k] are <= a[k], right are >=)
+ * @param a - array (without NaNs)
+ * @param n - its length
+ * @param k - rank (0..n-1)
+ * @return a[k]
+ */
+double il_qselect(double *a, size_t n, size_t k){
+    ssize_t l = 0, r = (ssize_t)n - 1;
+    int depth = 2 * (int)log2((double)n + 1.) + 8;
+    while(r - l > 16){
+        if(--depth < 0) break; // bad pivots: sort the rest
+        ssize_t m = l + (r - l) / 2;
+        if(a[m] < a[l]) DSWAP(m, l);
+        if(a[r] < a[l]) DSWAP(r, l);
+        if(a[r] < a[m]) DSWAP(r, m);
+        double pivot = a[m];
+        ssize_t i = l, j = r;
+        while(i <= j){
+            while(a[i] < pivot) ++i;
+            while(a[j] > pivot) --j;
+            if(i <= j){
+                DSWAP(i, j);
+                ++i; --j;
+            }
+        }
+        // now a[l..j] <= pivot, a[j+1..i-1] == pivot, a[i..r] >= pivot
+        if((ssize_t)k <= j) r = j;
+        else if((ssize_t)k >= i) l = i;
+        else return a[k];
+    }
+    if(r > l) qsort(a + l, r - l + 1, sizeof(double), cmpdbl);
+    return a[k];
+}
+#undef DSWAP
+
+/**
+ * @brief hist_select - values of order statistics by histogram
+ * @param H - histogram, value of bin `i` is `i + off`
+ * @param nr - amount of ranks
+ * @param ranks - ranks sorted ascending (less than sum of H)
+ * @param vals (o) - values
+ */
+static void hist_select(const size_t *H, double off, int nr, const size_t *ranks, double *vals){
+    size_t cum = 0;
+    int b = 0;
+    for(int r = 0; r < nr; ++r){
+        while(cum + H[b] <= ranks[r]) cum += H[b++];
+        vals[r] = b + off;
+    }
+}
+
+// growing per-thread buffer of gathered values
+typedef struct{
+    double *v;
+    size_t n;
+    size_t sz;
+} vbuf;
+
+static inline void vbuf_push(vbuf *b, double v){
+    if(b->n == b->sz){
+        b->sz = b->sz ? b->sz * 2 : 1024;
+        b->v = realloc(b->v, b->sz * sizeof(double));
+        if(!b->v) ERR("realloc()");
+    }
+    b->v[b->n++] = v;
+}
+
+// gather `val` of pixels from bins with slot[bin] >= 0 into per-thread buffers `tb[slot]`
+#define GATHER(type, ktype, val) do{ \
+    const double center = par.center; \
+    (void)center; \
+    _Pragma("omp for schedule(static)") \
+    for(int y = 0; y < h; ++y){ \
+        const type *p = IL_ROW(type, I, y); \
+        for(int x = 0; x < w; ++x){ \
+            uint64_t d = key_##ktype(val(p[x])) - par.kmin; \
+            if(d > par.krange) continue; \
+            int s = slot[d >> par.shift]; \
+            if(s >= 0) vbuf_push(&tb[s], (double)val(p[x])); \
+        } \
+    }}while(0)
+
+/**
+ * @brief select_wide - values of order statistics of non-NaN pixels of U32/F/D image (or of their absolute
+ *          deviations from `center`)
+ * @param I - image
+ * @param dev - TRUE to select absolute deviations
+ * @param center - center for deviations
+ * @param lo, hi - range of values (or deviations)
+ * @param nr - amount of ranks
+ * @param ranks - ranks sorted ascending (less than amount of non-NaN pixels)
+ * @param vals (o) - values
+ */
+static void select_wide(const il_Image *I, int dev, double center, double lo, double hi,
+                        int nr, const size_t *ranks, double *vals){
+    hcounter count;
+    double (*unkey)(uint64_t) = unkey_double;
+    uint64_t kmin = key_double(lo), kmax = key_double(hi);
+    switch(I->type){
+        case IMTYPE_U32:
+            if(dev) count = countd_uint32_t;
+            else{
+                count = countk_uint32_t; unkey = unkey_uint32_t;
+                kmin = key_uint32_t((uint32_t)lo); kmax = key_uint32_t((uint32_t)hi);
+            }
+        break;
+        case IMTYPE_F:
+            if(dev) count = countd_float;
+            else{
+                count = countk_float; unkey = unkey_float;
+                kmin = key_float((float)lo); kmax = key_float((float)hi);
+            }
+        break;
+        default:
+            count = dev ? countd_double : countk_double;
+    }
+    hpar par = {.kmin = kmin, .krange = kmax - kmin, .center = center};
+    while((par.krange >> par.shift) >= NBINSW) ++par.shift;
+    int nbins = par.nbins = (int)(par.krange >> par.shift) + 1;
+    size_t *H = MALLOC(size_t, nbins + 1);
+    histo_engine(I, count, nbins + 1, NSUBW, &par, H);
+    // bin of each rank and amount of values before it
+    int *rbin = MALLOC(int, nr);
+    size_t *rbase = MALLOC(size_t, nr);
+    size_t cum = 0;
+    int b = 0;
+    for(int r = 0; r < nr; ++r){
+        while(cum + H[b] <= ranks[r]) cum += H[b++];
+        rbin[r] = b;
+        rbase[r] = cum;
+    }
+    if(par.shift == 0){ // bin is key
+        for(int r = 0; r < nr; ++r) vals[r] = unkey(kmin + (uint64_t)rbin[r]);
+        FREE(rbase); FREE(rbin); FREE(H);
+        return;
+    }
+    // slots: different bins with ranks; rank r0[s]..r0[s+1]-1 are in slot s
+    int *slot = MALLOC(int, nbins);
+    int *r0 = MALLOC(int, nr + 1);
+    memset(slot, -1, nbins * sizeof(int));
+    int ns = 0;
+    for(int r = 0; r < nr; ++r){
+        if(slot[rbin[r]] >= 0) continue;
+        slot[rbin[r]] = ns;
+        r0[ns++] = r;
+    }
+    r0[ns] = nr;
+    int nthr = OMP_MAX_THREADS();
+    vbuf *tball = MALLOC(vbuf, (size_t)nthr * ns);
+    int w = I->width, h = I->height;
+#pragma omp parallel
+{
+    vbuf *tb = tball + (size_t)OMP_THREAD_NUM() * ns;
+    switch(I->type){
+        case IMTYPE_U32:
+            if(dev) GATHER(uint32_t, double, DEVVAL);
+            else GATHER(uint32_t, uint32_t, PIXVAL);
+        break;
+        case IMTYPE_F:
+            if(dev) GATHER(float, double, DEVVAL);
+            else GATHER(float, float, PIXVAL);
+        break;
+        default:
+            if(dev) GATHER(double, double, DEVVAL);
+            else GATHER(double, double, PIXVAL);
+    }
+}
+    OMP_FOR(schedule(dynamic))
+    for(int s = 0; s < ns; ++s){
+        size_t n = H[rbin[r0[s]]], pos = 0;
+        double *a = MALLOC(double, n);
+        for(int t = 0; t < nthr; ++t){
+            vbuf *v = &tball[(size_t)t * ns + s];
+            if(!v->n) continue;
+            memcpy(a + pos, v->v, v->n * sizeof(double));
+            pos += v->n;
+            FREE(v->v);
+        }
+        // ranks in slot are ascending: each next one is searched right of previous
+        size_t first = 0;
+        for(int r = r0[s]; r < r0[s+1]; ++r){
+            size_t k = ranks[r] - rbase[r];
+            vals[r] = il_qselect(a + first, n - first, k - first);
+            first = k;
+        }
+        FREE(a);
+    }
+    FREE(tball); FREE(r0); FREE(slot);
+    FREE(rbase); FREE(rbin); FREE(H);
+}
+#undef GATHER
+#undef PIXVAL
+#undef DEVVAL
+
+// sorted unique ranks of values needed for quantiles `q` of `N` values (floor and ceil of q*(N-1))
+static size_t *qranks(size_t N, int n, const double *q, int *nr){
+    size_t *r = MALLOC(size_t, 2 * n);
+    for(int i = 0; i < n; ++i){
+        size_t lo = (size_t)(q[i] * (N - 1));
+        r[2*i] = lo;
+        r[2*i+1] = (lo < N - 1) ? lo + 1 : lo;
+    }
+    qsort(r, 2 * n, sizeof(size_t), cmpsz);
+    int m = 1;
+    for(int i = 1; i < 2 * n; ++i) if(r[i] != r[m-1]) r[m++] = r[i];
+    *nr = m;
+    return r;
+}
+
+// linear interpolation of quantiles between values `rv` of ranks
+static void qinterp(size_t N, int n, const double *q, int nr, const size_t *ranks, const double *rv, double *val){
+    for(int i = 0; i < n; ++i){
+        double pos = q[i] * (N - 1);
+        size_t lo = (size_t)pos;
+        const size_t *p = bsearch(&lo, ranks, nr, sizeof(size_t), cmpsz);
+        double frac = pos - lo, v = rv[p - ranks];
+        if(frac > 0.) v += frac * (rv[p - ranks + 1] - v);
+        val[i] = v;
+    }
+}
+
+// histogram of all values of U8/U16 image (nvals bins): copy of cached one
+static size_t *natural_histo(const il_Image *I, int *nvals){
+    if(I->type == IMTYPE_U8){
+        *nvals = 256;
+        return il_histogram8(I);
+    }
+    *nvals = 65536;
+    return il_histogram16(I);
+}
+
+// amount of non-NaN pixels and statistics (for U32/F/D)
+static size_t npixels(const il_Image *I, il_Stats *st){
+    if(I->type == IMTYPE_U8 || I->type == IMTYPE_U16) return (size_t)I->width * I->height;
+    if(!il_Image_stats((il_Image*)I, st)) return 0; // cache is the only thing we could change here
+    return st->npix;
+}
+
+/**
+ * @brief il_Image_percentiles - calculate several quantiles of non-NaN pixel values at once
+ *          (with linear interpolation between order statistics: quantile q is value at position q*(N-1)
+ *          of sorted array of N values)
+ * @param I - image
+ * @param n - amount of quantiles
+ * @param q - quantiles (0..1), e.g. 0.5 for median
+ * @param val (o) - their values
+ * @return FALSE if error
+ */
+int il_Image_percentiles(const il_Image *I, int n, const double *q, double *val){
+    if(!I || !I->data || I->type >= IMTYPE_AMOUNT || n < 1 || !q || !val) return FALSE;
+    for(int i = 0; i < n; ++i) if(!(q[i] >= 0. && q[i] <= 1.)){
+        WARNX("il_Image_percentiles(): quantile should be in [0, 1]");
+        return FALSE;
+    }
+    il_Stats st;
+    size_t N = npixels(I, &st);
+    if(N == 0){
+        WARNX("il_Image_percentiles(): no pixels");
+        return FALSE;
+    }
+    int nr;
+    size_t *ranks = qranks(N, n, q, &nr);
+    double *rv = MALLOC(double, nr);
+    if(I->type == IMTYPE_U8 || I->type == IMTYPE_U16){
+        int nvals;
+        size_t *H = natural_histo(I, &nvals);
+        hist_select(H, 0., nr, ranks, rv);
+        FREE(H);
+    }else select_wide(I, FALSE, 0., st.min, st.max, nr, ranks, rv);
+    qinterp(N, n, q, nr, ranks, rv, val);
+    FREE(rv);
+    FREE(ranks);
+    return TRUE;
+}
+
+/**
+ * @brief il_Image_median - median of non-NaN pixel values
+ * @param I - image
+ * @param med (o) - median
+ * @return FALSE if error
+ */
+int il_Image_median(const il_Image *I, double *med){
+    const double q = 0.5;
+    if(!med) return FALSE;
+    return il_Image_percentiles(I, 1, &q, med);
+}
+
+/**
+ * @brief il_Image_mad - median absolute deviation from median (for normal distribution sigma = 1.4826*MAD)
+ * @param I - image
+ * @param med (o) - median (may be NULL)
+ * @param mad (o) - MAD
+ * @return FALSE if error
+ */
+int il_Image_mad(const il_Image *I, double *med, double *mad){
+    if(!I || !I->data || I->type >= IMTYPE_AMOUNT || !mad) return FALSE;
+    const double q = 0.5;
+    double m;
+    if(I->type == IMTYPE_U8 || I->type == IMTYPE_U16){ // both by histogram of values
+        size_t N = (size_t)I->width * I->height;
+        int nr, nvals;
+        size_t *ranks = qranks(N, 1, &q, &nr);
+        double rv[2];
+        size_t *H = natural_histo(I, &nvals);
+        hist_select(H, 0., nr, ranks, rv);
+        qinterp(N, 1, &q, nr, ranks, rv, &m);
+        // deviations are j + off, off = 0 for integer median and 0.5 for half-integer one
+        int mi = (int)m;
+        double off = m - mi;
+        size_t *dev = MALLOC(size_t, nvals + 1);
+        for(int v = 0; v < nvals; ++v){
+            int j = (v > mi) ? v - mi - (off > 0.) : mi - v;
+            dev[j] += H[v];
+        }
+        hist_select(dev, off, nr, ranks, rv);
+        qinterp(N, 1, &q, nr, ranks, rv, mad);
+        FREE(dev);
+        FREE(H);
+        FREE(ranks);
+    }else{ // by keys of deviations
+        il_Stats st;
+        size_t N = npixels(I, &st);
+        if(N == 0 || !il_Image_median(I, &m)) return FALSE;
+        double dmax = fmax(m - st.min, st.max - m);
+        int nr;
+        size_t *ranks = qranks(N, 1, &q, &nr);
+        double rv[2];
+        select_wide(I, TRUE, m, 0., dmax, nr, ranks, rv);
+        qinterp(N, 1, &q, nr, ranks, rv, mad);
+        FREE(ranks);
+    }
+    if(med) *med = m;
+    return TRUE;
+}
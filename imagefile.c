@@ -17,11 +17,17 @@
  */
 
 #include <dirent.h>
+#include <float.h>
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#if defined __AVX2__
+#include <immintrin.h>
+#endif
 
 #include "stb/stb_image.h"
 #include "stb/stb_image_write.h"
@@ -75,6 +81,58 @@ int il_getpixbytes(il_imtype_t type){
     return bytes[type];
 }
 
+/**
+ * @brief il_getpitch - calculate row pitch for image of given width and type
+ * @param w - image width (pixels)
+ * @param type - pixel type
+ * @return amount of bytes per row rounded up to IL_ALIGN or 0 if error
+ */
+size_t il_getpitch(int w, il_imtype_t type){
+    if(w < 1 || type >= IMTYPE_AMOUNT) return 0;
+    size_t pitch = (size_t)w * bytes[type];
+    return (pitch + IL_ALIGN - 1) / IL_ALIGN * IL_ALIGN;
+}
+
+static int allocmode = 0;
+/**
+ * @brief il_AllocSetMode - change allocation mode of il_alloc_rows (and so all image allocators)
+ * @param mode - IL_ALLOC_xx flags (0 - default: zero-filling by calling thread)
+ * @return previous mode
+ */
+int il_AllocSetMode(int mode){
+    int old = allocmode;
+    allocmode = mode;
+    return old;
+}
+
+// size of transparent huge page
+#define HUGEPAGESZ  (2UL*1024UL*1024UL)
+
+/**
+ * @brief il_alloc_rows - allocate zero-filled memory for `h` rows of `pitch` bytes aligned to IL_ALIGN
+ *          with IL_ALLOC_FIRSTTOUCH rows are zeroed (and so physically allocated on NUMA node of
+ *          the thread that will process them) by OMP_FOR with static schedule, like in all row kernels
+ * @param pitch - bytes per row
+ * @param h - amount of rows
+ * @return allocated memory (free it by free()) or NULL if wrong parameters
+ */
+void *il_alloc_rows(size_t pitch, int h){
+    if(!pitch || h < 1) return NULL;
+    void *ptr = NULL;
+    size_t S = pitch * (size_t)h, align = IL_ALIGN;
+    int huge = (allocmode & IL_ALLOC_HUGEPAGES) && S >= HUGEPAGESZ;
+    if(huge) align = HUGEPAGESZ;
+    if(posix_memalign(&ptr, align, S)) ERR("posix_memalign()");
+#ifdef MADV_HUGEPAGE
+    if(huge) madvise(ptr, S, MADV_HUGEPAGE); // should be done before first touch
+#endif
+    if((allocmode & IL_ALLOC_FIRSTTOUCH) && h > 1){
+        OMP_FOR(schedule(static))
+        for(int y = 0; y < h; ++y) memset((uint8_t*)ptr + (size_t)y*pitch, 0, pitch);
+    }else memset(ptr, 0, S);
+    return ptr;
+}
+
 /**
  * @brief imtype - check image type of given file
  * @param f - opened image file structure
@@ -142,11 +200,19 @@ il_InputType il_chkinput(const char *name){
  * @param height    - image height
  * @param stride    - image width with alignment
  * @return Image structure (fully allocated, you can FREE(data) after it)
+ * (use il_Image_wrap() to avoid copying)
  */
 il_Image *il_u82Image(const uint8_t *data, int width, int height){
+    return il_u82ImageP(NULL, data, width, height);
+}
+// the same as il_u82Image but with image from pool `p`
+il_Image *il_u82ImageP(il_ImagePool *p, const uint8_t *data, int width, int height){
     FNAME();
-    il_Image *outp = il_Image_new(width, height, IMTYPE_U8);
-    memcpy(outp->data, data, width*height);
+    il_Image *outp = il_Image_newP(p, width, height, IMTYPE_U8);
+    if(!outp) return NULL;
+    OMP_FOR()
+    for(int y = 0; y < height; ++y)
+        memcpy(IL_ROW(uint8_t, outp, y), &data[(size_t)y*width], width);
     il_Image_minmax(outp);
     return outp;
 }
@@ -169,6 +235,7 @@ static inline il_Image *im_loadmono(const char *name){
     I->height = height;
     I->type = IMTYPE_U8;
     I->pixbytes = 1;
+    I->pitch = width; // stb_image gives us data without alignment
     il_Image_minmax(I);
     return I;
 }
@@ -222,8 +289,8 @@ il_Image *il_Image_new(int w, int h, il_imtype_t type){
     o->height = h;
     o->type = type;
     o->pixbytes = il_getpixbytes(type);
-    o->data = calloc(w*h, o->pixbytes);
-    if(!o->data) ERR("calloc()");
+    o->pitch = il_getpitch(w, type);
+    o->data = il_alloc_rows(o->pitch, h);
     return o;
 }
 
@@ -238,14 +305,147 @@ il_Image *il_Image_sim(const il_Image *i){
     return outp;
 }
 
-// free image data
+// `release` for non-owning il_Image_wrap()
+static void norelease(void *data, void *ctx){
+    (void)data; (void)ctx;
+}
+
+/**
+ * @brief il_Image_wrap - make image over external pixel buffer without copying
+ * @param data - pixel data (e.g. DMA/V4L2 buffer or shared memory)
+ * @param w, h - image size
+ * @param type - pixel type
+ * @param pitch - bytes per row (0 - w*pixbytes)
+ * @param release - function which will be called by il_Image_free() to release `data`
+ *                  (ownership transfer), or NULL if caller keeps data
+ * @param ctx - context for `release` (e.g. buffer index in camera ring)
+ * @return image header allocated here (free it by il_Image_free()) or NULL if error
+ */
+il_Image *il_Image_wrap(void *data, int w, int h, il_imtype_t type, size_t pitch,
+                        void (*release)(void *data, void *ctx), void *ctx){
+    if(!data || w < 1 || h < 1 || type >= IMTYPE_AMOUNT) return NULL;
+    size_t rowbytes = (size_t)w * bytes[type];
+    if(!pitch) pitch = rowbytes;
+    else if(pitch < rowbytes){
+        WARNX("il_Image_wrap(): pitch is less than row size");
+        return NULL;
+    }
+    il_Image *o = MALLOC(il_Image, 1);
+    o->width = w;
+    o->height = h;
+    o->type = type;
+    o->pixbytes = bytes[type];
+    o->data = data;
+    o->pitch = pitch;
+    o->release = release ? release : norelease;
+    o->relctx = ctx;
+    return o;
+}
+
+/**
+ * @brief il_ImageView_set - make window (w x h pixels @ x0,y0) over `parent` without copying data
+ *        (window is clipped by parent borders)
+ * @param V (o) - view to fill (e.g. on stack)
+ * @param parent - image owning data
+ * @param x0, y0 - left upper corner of window
+ * @param w, h - window size
+ * @return FALSE if window is outside of image
+ */
+int il_ImageView_set(il_ImageView *V, il_Image *parent, int x0, int y0, int w, int h){
+    if(!V || !parent || !parent->data || w < 1 || h < 1) return FALSE;
+    int x1 = x0 + w, y1 = y0 + h;
+    if(x0 < 0) x0 = 0;
+    if(y0 < 0) y0 = 0;
+    if(x1 > parent->width) x1 = parent->width;
+    if(y1 > parent->height) y1 = parent->height;
+    if(x0 >= x1 || y0 >= y1) return FALSE;
+    V->parent = parent;
+    V->x0 = x0; V->y0 = y0;
+    V->I = *parent;
+    V->I.pool = NULL;
+    V->I.release = NULL;
+    V->I.relctx = NULL;
+    V->I.parent = parent;
+    V->I.modcnt = 0;
+    memset(&V->I.stat, 0, sizeof(il_ImStat));
+    V->I.width = x1 - x0;
+    V->I.height = y1 - y0;
+    V->I.data = (uint8_t*)IL_ROW(uint8_t, parent, y0) + (size_t)x0 * parent->pixbytes;
+    V->I.minval = V->I.maxval = 0.;
+    return TRUE;
+}
+
+// free image data (or return it into its pool)
 void il_Image_free(il_Image **img){
     if(!img || !*img) return;
+    if((*img)->pool){ // histogram cache is kept for reuse
+        il_ImagePool_put((*img)->pool, (*img)->data);
+        *img = NULL;
+        return;
+    }
+    FREE((*img)->stat.histogram);
+    if((*img)->release){
+        (*img)->release((*img)->data, (*img)->relctx);
+        FREE(*img);
+        return;
+    }
     FREE((*img)->data);
     FREE(*img);
 }
 
 
+/**
+ * @brief il_Image_modified - mark image data (and data of its parents if image is a view) as changed,
+ *        so all cached statistics will be recalculated
+ * @param I - image
+ */
+void il_Image_modified(il_Image *I){
+    for(; I; I = I->parent) ++I->modcnt;
+}
+
+// views don't cache statistics: their `modcnt` isn't changed when parent data is modified; tile views
+// (without parent) are marked by IL_STAT_NOCACHE
+static inline int nocache(const il_Image *I){
+    return I->parent || (I->stat.flags & IL_STAT_NOCACHE);
+}
+
+// check if statistics `flag` is in cache (& clear all cache if data was changed)
+static int stat_cached(il_Image *I, uint32_t flag){
+    if(nocache(I)) return FALSE;
+    if(I->stat.stamp != I->modcnt){
+        I->stat.stamp = I->modcnt;
+        I->stat.flags = 0;
+        return FALSE;
+    }
+    return (I->stat.flags & flag) ? TRUE : FALSE;
+}
+
+// get histogram from cache or calculate and store it there (histograms of views aren't cached)
+static size_t *cached_histo(const il_Image *I, int nbins, void (*calc)(const il_Image*, size_t*)){
+    il_Image *cI = (il_Image*)I; // cache is the only thing we could change here
+    size_t *histogram = MALLOC(size_t, nbins);
+    if(stat_cached(cI, IL_STAT_HISTO)){
+        memcpy(histogram, cI->stat.histogram, nbins*sizeof(size_t));
+        return histogram;
+    }
+    calc(I, histogram);
+    if(nocache(I)) return histogram;
+    if(!cI->stat.histogram) cI->stat.histogram = MALLOC(size_t, nbins);
+    memcpy(cI->stat.histogram, histogram, nbins*sizeof(size_t));
+    cI->stat.flags |= IL_STAT_HISTO;
+    return histogram;
+}
+
+// one bin per value of U8/U16 image
+static void histo8(const il_Image *I, size_t *histogram){
+    il_Histogram H = {.nbins = 256, .min = 0., .max = 256., .bins = histogram};
+    il_Histogram_fill(&H, I);
+}
+static void histo16(const il_Image *I, size_t *histogram){
+    il_Histogram H = {.nbins = 65536, .min = 0., .max = 65536., .bins = histogram};
+    il_Histogram_fill(&H, I);
+}
+
 /**
  * @brief il_histogram8 - calculate image histogram for 8-bit image
  * @param I - orig
@@ -253,27 +453,7 @@ void il_Image_free(il_Image **img){
  */
 size_t *il_histogram8(const il_Image *I){
     if(!I || !I->data || I->type != IMTYPE_U8) return NULL;
-    size_t *histogram = MALLOC(size_t, 256);
-    int wh = I->width * I->height;
-    uint8_t *data = (uint8_t*)I->data;
-#pragma omp parallel
-{
-    size_t histogram_private[256] = {0};
-    #pragma omp for nowait
-    for(int i = 0; i < wh; ++i){
-        ++histogram_private[data[i]];
-    }
-    #pragma omp critical
-    {
-        for(int i = 0; i < 256; ++i) histogram[i] += histogram_private[i];
-    }
-}
-#if 0
-    for(int i = 0; i < wh; ++i){
-        ++histogram[data[i]];
-    }
-#endif
-    return histogram;
+    return cached_histo(I, 256, histo8);
 }
 
 /**
@@ -283,57 +463,97 @@ size_t *il_histogram8(const il_Image *I){
  */
 size_t *il_histogram16(const il_Image *I){
     if(!I || !I->data || I->type != IMTYPE_U16) return NULL;
-    size_t *histogram = MALLOC(size_t, 65536);
-    int wh = I->width * I->height;
-    uint16_t *data = (uint16_t*)I->data;
-#pragma omp parallel
-{
-    size_t histogram_private[65536] = {0};
-    #pragma omp for nowait
-    for(int i = 0; i < wh; ++i){
-        ++histogram_private[data[i]];
-    }
-    #pragma omp critical
-    {
-        for(int i = 0; i < 65536; ++i) histogram[i] += histogram_private[i];
+    return cached_histo(I, 65536, histo16);
+}
+
+// calculate histogram band by band (il_histogram8/16 of views aren't cached)
+static void histoS(il_Image *I, int bandh, size_t *histogram){
+    int nbins = (I->type == IMTYPE_U8) ? 256 : 65536;
+    for(int y0 = 0; y0 < I->height; y0 += bandh){
+        il_ImageView V;
+        il_ImageView_set(&V, I, 0, y0, I->width, bandh);
+        il_Image_advise(I, y0 + bandh, bandh, IL_ADV_WILLNEED);
+        size_t *h = (nbins == 256) ? il_histogram8(&V.I) : il_histogram16(&V.I);
+        il_Image_advise(I, y0, bandh, IL_ADV_DONTNEED);
+        for(int i = 0; i < nbins; ++i) histogram[i] += h[i];
+        FREE(h);
     }
 }
+
+/**
+ * @brief il_histogramS - the same as il_histogram8/il_histogram16 but band by band (for mmap'ed images)
+ * @param I - U8 or U16 image
+ * @param bandh - band height (rows) or 0 for IL_BANDHEIGHT
+ * @return allocated here array of 256 or 65536 bins
+ */
+size_t *il_histogramS(il_Image *I, int bandh){
+    if(!I || !I->data) return NULL;
+    int nbins;
+    switch(I->type){
+        case IMTYPE_U8:
+            nbins = 256;
+        break;
+        case IMTYPE_U16:
+            nbins = 65536;
+        break;
+        default:
+            WARNX("il_histogramS(): supported only 8- and 16-bit images");
+            return NULL;
+    }
+    if(bandh < 1) bandh = IL_BANDHEIGHT;
+    size_t *histogram = MALLOC(size_t, nbins);
+    if(stat_cached(I, IL_STAT_HISTO)){
+        memcpy(histogram, I->stat.histogram, nbins*sizeof(size_t));
+        return histogram;
+    }
+    histoS(I, bandh, histogram);
+    if(nocache(I)) return histogram;
+    if(!I->stat.histogram) I->stat.histogram = MALLOC(size_t, nbins);
+    memcpy(I->stat.histogram, histogram, nbins*sizeof(size_t));
+    I->stat.flags |= IL_STAT_HISTO;
     return histogram;
 }
 
 
 /**
- * @brief calc_background - Simple background calculation by histogram
+ * @brief il_Image_background - Simple background calculation by histogram (of values for U8/U16, 65536 bins for others)
  * @param img (i) - input image (here will be modified its top2proc field)
  * @param bk (o)  - background value
  * @return 0 if error
  */
 int il_Image_background(il_Image *img, double *bkg){
     if(!img || !img->data || !bkg) return FALSE;
+    if(stat_cached(img, IL_STAT_BKG)){
+        *bkg = img->stat.bkg;
+        return TRUE;
+    }
     il_Image_minmax(img);
     if(img->maxval == img->minval){
         WARNX("Zero or overilluminated image!");
         return FALSE;
     }
-    size_t *histogram = NULL;
-    int histosize = 0;
+    // U8/U16: cached histogram with one bin per value; others: 65536 bins over [minval, maxval]
+    il_Histogram H = {0}, *Hp = NULL;
     switch(img->type){
         case IMTYPE_U8:
-            histogram = il_histogram8(img);
-            histosize = 256;
+            H = (il_Histogram){.nbins = 256, .min = 0., .max = 256., .bins = il_histogram8(img)};
         break;
         case IMTYPE_U16:
-            histogram = il_histogram16(img);
-            histosize = 65536;
+            H = (il_Histogram){.nbins = 65536, .min = 0., .max = 65536., .bins = il_histogram16(img)};
         break;
         default:
-        break;
+            Hp = il_Image_histogram(img, 0, 0., 0.);
+            if(Hp){
+                H = *Hp;
+                FREE(Hp);
+            }
     }
-    if(!histogram){
-        WARNX("calc_background() supported only 8- and 16-bit images");
+    if(!H.bins){
+        WARNX("il_Image_background(): can't calculate histogram");
         return FALSE;
     }
-
+    size_t *histogram = H.bins;
+    int histosize = H.nbins;
     size_t modeidx = 0, modeval = 0;
     for(int i = 0; i < histosize; ++i)
         if(modeval < histogram[i]){
@@ -344,27 +564,29 @@ int il_Image_background(il_Image *img, double *bkg){
     ssize_t *diff2 = MALLOC(ssize_t, histosize);
     int lastidx = histosize - 1;
     OMP_FOR()
-    for(int i = 2; i < lastidx; ++i)
+    for(int i = 2; i < lastidx - 1; ++i)
         diff2[i] = (histogram[i+2]+histogram[i-2]-2*histogram[i])/4;
     //green("HISTO:\n");
     //for(int i = 0; i < 256; ++i) printf("%d:\t%d\t%d\n", i, histogram[i], diff2[i]);
     FREE(histogram);
     if(modeidx < 2) modeidx = 2;
-    if((int)modeidx > lastidx-1){
+    if((int)modeidx > lastidx-2){
         WARNX("Overilluminated image");
         FREE(diff2);
         return FALSE; // very bad image: overilluminated
     }
     size_t borderidx = modeidx;
-    for(int i = modeidx; i < lastidx; ++i){ // search bend-point by second derivate
+    for(int i = modeidx; i < lastidx-2; ++i){ // search bend-point by second derivate
         if(diff2[i] <= 0 && diff2[i+1] <= 0){
             borderidx = i; break;
         }
     }
     //DBG("borderidx=%d -> %d", borderidx, (borderidx+modeidx)/2);
     //*bk = (borderidx + modeidx) / 2;
-    *bkg = borderidx;
+    *bkg = H.min + borderidx * (H.max - H.min) / H.nbins; // lower edge of bin
     FREE(diff2);
+    img->stat.bkg = *bkg;
+    img->stat.flags |= IL_STAT_BKG;
     return TRUE;
 }
 
@@ -379,13 +601,13 @@ uint8_t *il_equalize8(il_Image *I, int nchannels, double throwpart){
     if(!I || !I->data || (nchannels != 1 && nchannels != 3)) return NULL;
     il_Image_minmax(I);
     int width = I->width, height = I->height;
-    size_t stride = width*nchannels, S = height*stride;
+    size_t stride = (size_t)width*nchannels, S = height*stride;
     size_t *orig_histo = il_histogram8(I); // original hystogram (linear)
     if(!orig_histo) return NULL;
     uint8_t *outp = MALLOC(uint8_t, S);
     uint8_t eq_levls[256] = {0};   // levels to convert: newpix = eq_levls[oldpix]
-    int s = width*height;
-    int Nblack = 0, bpart = (int)(throwpart * (double)s);
+    size_t s = (size_t)width*height;
+    size_t Nblack = 0, bpart = (size_t)(throwpart * (double)s);
     int startidx;
     // remove first part of black pixels
     for(startidx = 0; startidx < 256; ++startidx){
@@ -404,12 +626,11 @@ uint8_t *il_equalize8(il_Image *I, int nchannels, double throwpart){
     DBG("Original / new histogram");
     for(int i = 0; i < 256; ++i) printf("%d\t%d\t%d\n", i, orig_hysto[i], eq_levls[i]);
 #endif
-    uint8_t *Idata = (uint8_t*)I->data;
     if(nchannels == 3){
         OMP_FOR()
         for(int y = 0; y < height; ++y){
-            uint8_t *Out = &outp[y*stride];
-            uint8_t *In = &Idata[y*width];
+            uint8_t *Out = &outp[(size_t)y*stride];
+            uint8_t *In = IL_ROW(uint8_t, I, y);
             for(int x = 0; x < width; ++x){
                 Out[0] = Out[1] = Out[2] = eq_levls[*In++];
                 Out += 3;
@@ -418,8 +639,8 @@ uint8_t *il_equalize8(il_Image *I, int nchannels, double throwpart){
     }else{
         OMP_FOR()
         for(int y = 0; y < height; ++y){
-            uint8_t *Out = &outp[y*width];
-            uint8_t *In = &Idata[y*width];
+            uint8_t *Out = &outp[(size_t)y*width];
+            uint8_t *In = IL_ROW(uint8_t, I, y);
             for(int x = 0; x < width; ++x){
                 *Out++ = eq_levls[*In++];
             }
@@ -440,13 +661,13 @@ uint8_t *il_equalize16(il_Image *I, int nchannels, double throwpart){
     if(!I || !I->data || (nchannels != 1 && nchannels != 3)) return NULL;
     il_Image_minmax(I);
     int width = I->width, height = I->height;
-    size_t stride = width*nchannels, S = height*stride;
-    size_t *orig_histo = il_histogram8(I); // original hystogram (linear)
+    size_t stride = (size_t)width*nchannels, S = height*stride;
+    size_t *orig_histo = il_histogram16(I); // original hystogram (linear)
     if(!orig_histo) return NULL;
     uint8_t *outp = MALLOC(uint8_t, S);
-    uint16_t *eq_levls = MALLOC(uint16_t, 65536);   // levels to convert: newpix = eq_levls[oldpix]
-    int s = width*height;
-    int Nblack = 0, bpart = (int)(throwpart * (double)s);
+    uint8_t *eq_levls = MALLOC(uint8_t, 65536);   // levels to convert: newpix = eq_levls[oldpix]
+    size_t s = (size_t)width*height;
+    size_t Nblack = 0, bpart = (size_t)(throwpart * (double)s);
     int startidx;
     // remove first part of black pixels
     for(startidx = 0; startidx < 65536; ++startidx){
@@ -455,17 +676,16 @@ uint8_t *il_equalize16(il_Image *I, int nchannels, double throwpart){
     }
     ++startidx;
     //DBG("Throw %d (real: %d black) pixels, startidx=%d", bpart, Nblack, startidx);
-    double part = (double)(s + 1. - Nblack) / 65536., N = 0.;
+    double part = (double)(s + 1. - Nblack) / 256., N = 0.;
     for(int i = startidx; i < 65536; ++i){
         N += orig_histo[i];
         eq_levls[i] = (uint8_t)(N/part);
     }
-    uint8_t *Idata = (uint8_t*)I->data;
     if(nchannels == 3){
         OMP_FOR()
         for(int y = 0; y < height; ++y){
-            uint8_t *Out = &outp[y*stride];
-            uint8_t *In = &Idata[y*width];
+            uint8_t *Out = &outp[(size_t)y*stride];
+            uint16_t *In = IL_ROW(uint16_t, I, y);
             for(int x = 0; x < width; ++x){
                 Out[0] = Out[1] = Out[2] = eq_levls[*In++];
                 Out += 3;
@@ -474,8 +694,8 @@ uint8_t *il_equalize16(il_Image *I, int nchannels, double throwpart){
     }else{
         OMP_FOR()
         for(int y = 0; y < height; ++y){
-            uint8_t *Out = &outp[y*width];
-            uint8_t *In = &Idata[y*width];
+            uint8_t *Out = &outp[(size_t)y*width];
+            uint16_t *In = IL_ROW(uint16_t, I, y);
             for(int x = 0; x < width; ++x){
                 *Out++ = eq_levls[*In++];
             }
@@ -486,143 +706,315 @@ uint8_t *il_equalize16(il_Image *I, int nchannels, double throwpart){
     return outp;
 }
 
-static void u8minmax(il_Image *I){
-    uint8_t *data = (uint8_t*)I->data;
-    double min = *data, max = min;
-    int wh = I->width * I->height;
-    #pragma omp parallel shared(min, max)
-    {
-        double min_p = min, max_p = max;
-        #pragma omp for nowait
-        for(int i = 0; i < wh; ++i){
-            double pixval = (double)data[i];
-            if(pixval < min_p) min_p = pixval;
-            else if(pixval > max_p) max_p = pixval;
-        }
-        #pragma omp critical
-        {
-            if(min > min_p) min = min_p;
-            if(max < max_p) max = max_p;
-        }
-    }
-    I->maxval = max;
-    I->minval = min;
+/*
+ * Image statistics: one pass over data by row kernels (vectorized) with per-thread partials. Index of
+ * extremal value is searched by second pass only over rows where extremum was changed.
+ */
+// statistics of one row
+typedef struct{
+    double min, max, sum, sum2;
+    size_t npix, nsat;
+} rowstat;
+
+// U8/U16: integer accumulators are exact and vectorized by compiler as is
+#define ROWSTATI(type, sat) \
+static void rowstat_##type(const type *restrict in, int w, rowstat *r){ \
+    type mn = in[0], mx = in[0]; \
+    uint64_t s = 0, s2 = 0, nsat = 0; \
+    for(int x = 0; x < w; ++x){ \
+        type v = in[x]; \
+        mn = (v < mn) ? v : mn; \
+        mx = (v > mx) ? v : mx; \
+        s += v; \
+        s2 += (uint64_t)v * v; \
+        nsat += (v == sat); \
+    } \
+    r->min = mn; r->max = mx; r->sum = (double)s; r->sum2 = (double)s2; \
+    r->npix = w; r->nsat = nsat; \
 }
-static void u16minmax(il_Image *I){
-    uint16_t *data = (uint16_t*)I->data;
-    double min = *data, max = min;
-    int wh = I->width * I->height;
-    #pragma omp parallel shared(min, max)
-    {
-        double min_p = min, max_p = max;
-        #pragma omp for nowait
-        for(int i = 0; i < wh; ++i){
-            double pixval = (double)data[i];
-            if(pixval < min_p) min_p = pixval;
-            else if(pixval > max_p) max_p = pixval;
-        }
-        #pragma omp critical
-        {
-            if(min > min_p) min = min_p;
-            if(max < max_p) max = max_p;
-        }
-    }
-    I->maxval = max;
-    I->minval = min;
+
+#if defined __AVX2__
+// horizontal sum/min/max of vectors
+static inline double hsum_pd(__m256d v){
+    __m128d x = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(x, _mm_unpackhi_pd(x, x)));
 }
-static void u32minmax(il_Image *I){
-    uint32_t *data = (uint32_t*)I->data;
-    double min = *data, max = min;
-    int wh = I->width * I->height;
-    #pragma omp parallel shared(min, max)
-    {
-        double min_p = min, max_p = max;
-        #pragma omp for nowait
-        for(int i = 0; i < wh; ++i){
-            double pixval = (double)data[i];
-            if(pixval < min_p) min_p = pixval;
-            else if(pixval > max_p) max_p = pixval;
-        }
-        #pragma omp critical
-        {
-            if(min > min_p) min = min_p;
-            if(max < max_p) max = max_p;
-        }
+static inline double hmin_pd(__m256d v){
+    __m128d x = _mm_min_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_min_sd(x, _mm_unpackhi_pd(x, x)));
+}
+static inline double hmax_pd(__m256d v){
+    __m128d x = _mm_max_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_max_sd(x, _mm_unpackhi_pd(x, x)));
+}
+// add squares of 8 values `lo`,`hi` to sums `s` and `s2`
+#define ACC8(lo, hi) do{ \
+    s0 = _mm256_add_pd(s0, lo); s1 = _mm256_add_pd(s1, hi); \
+    q0 = _mm256_add_pd(q0, _mm256_mul_pd(lo, lo)); q1 = _mm256_add_pd(q1, _mm256_mul_pd(hi, hi)); \
+    }while(0)
+#define ACCINIT() __m256d s0 = _mm256_setzero_pd(), s1 = s0, q0 = s0, q1 = s0
+#define ACCDONE() do{ \
+    r->sum = hsum_pd(_mm256_add_pd(s0, s1)); r->sum2 = hsum_pd(_mm256_add_pd(q0, q1)); \
+    }while(0)
+
+// U32: min/max in integers, values are converted to double as signed (v - 2^31) + 2^31
+static void rowstat_uint32_t(const uint32_t *restrict in, int w, rowstat *r){
+    const __m256i sgn = _mm256_set1_epi32((int)0x80000000), ones = _mm256_set1_epi32(-1);
+    const __m256d off = _mm256_set1_pd(2147483648.);
+    __m256i mn = _mm256_set1_epi32(-1), mx = _mm256_setzero_si256();
+    ACCINIT();
+    size_t nsat = 0;
+    int x = 0;
+    for(; x + 8 <= w; x += 8){
+        __m256i v = _mm256_loadu_si256((const __m256i*)(in + x));
+        mn = _mm256_min_epu32(mn, v);
+        mx = _mm256_max_epu32(mx, v);
+        nsat += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, ones))));
+        __m256i sv = _mm256_xor_si256(v, sgn);
+        __m256d lo = _mm256_add_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(sv)), off);
+        __m256d hi = _mm256_add_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(sv, 1)), off);
+        ACC8(lo, hi);
     }
-    I->maxval = max;
-    I->minval = min;
+    uint32_t m[8], M[8];
+    _mm256_storeu_si256((__m256i*)m, mn);
+    _mm256_storeu_si256((__m256i*)M, mx);
+    uint32_t vmin = m[0], vmax = M[0];
+    for(int l = 1; l < 8; ++l){
+        if(m[l] < vmin) vmin = m[l];
+        if(M[l] > vmax) vmax = M[l];
+    }
+    ACCDONE();
+    for(; x < w; ++x){
+        uint32_t v = in[x];
+        if(v < vmin) vmin = v;
+        if(v > vmax) vmax = v;
+        r->sum += v; r->sum2 += (double)v * v;
+        nsat += (v == UINT32_MAX);
+    }
+    r->min = vmin; r->max = vmax;
+    r->npix = w; r->nsat = nsat;
 }
-static void fminmax(il_Image *I){
-    float *data = (float*)I->data;
-    double min = *data, max = min;
-    int wh = I->width * I->height;
-    #pragma omp parallel shared(min, max)
-    {
-        double min_p = min, max_p = max;
-        #pragma omp for nowait
-        for(int i = 0; i < wh; ++i){
-            double pixval = (double)data[i];
-            if(pixval < min_p) min_p = pixval;
-            else if(pixval > max_p) max_p = pixval;
-        }
-        #pragma omp critical
-        {
-            if(min > min_p) min = min_p;
-            if(max < max_p) max = max_p;
-        }
+
+// float/double: NaNs are skipped (min/max instructions return second operand if first is NaN)
+static void rowstat_float(const float *restrict in, int w, rowstat *r){
+    __m256 mn = _mm256_set1_ps(INFINITY), mx = _mm256_set1_ps(-INFINITY);
+    ACCINIT();
+    size_t nnan = 0;
+    int x = 0;
+    for(; x + 8 <= w; x += 8){
+        __m256 v = _mm256_loadu_ps(in + x), ok = _mm256_cmp_ps(v, v, _CMP_ORD_Q);
+        mn = _mm256_min_ps(v, mn);
+        mx = _mm256_max_ps(v, mx);
+        nnan += __builtin_popcount(~_mm256_movemask_ps(ok) & 0xff);
+        v = _mm256_and_ps(v, ok);
+        __m256d lo = _mm256_cvtps_pd(_mm256_castps256_ps128(v)), hi = _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1));
+        ACC8(lo, hi);
     }
-    I->maxval = max;
-    I->minval = min;
+    double vmin = hmin_pd(_mm256_min_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(mn)), _mm256_cvtps_pd(_mm256_extractf128_ps(mn, 1))));
+    double vmax = hmax_pd(_mm256_max_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(mx)), _mm256_cvtps_pd(_mm256_extractf128_ps(mx, 1))));
+    ACCDONE();
+    for(; x < w; ++x){
+        double v = in[x];
+        if(v != v){ ++nnan; continue; }
+        if(v < vmin) vmin = v;
+        if(v > vmax) vmax = v;
+        r->sum += v; r->sum2 += v * v;
+    }
+    r->min = vmin; r->max = vmax;
+    r->npix = w - nnan; r->nsat = 0;
 }
-static void dminmax(il_Image *I){
-    double *data = (double*)I->data;
-    double min = *data, max = min;
-    int wh = I->width * I->height;
-    #pragma omp parallel shared(min, max)
-    {
-        double min_p = min, max_p = max;
-        #pragma omp for nowait
-        for(int i = 0; i < wh; ++i){
-            double pixval = (double)data[i];
-            if(pixval < min_p) min_p = pixval;
-            else if(pixval > max_p) max_p = pixval;
-        }
-        #pragma omp critical
-        {
-            if(min > min_p) min = min_p;
-            if(max < max_p) max = max_p;
-        }
+static void rowstat_double(const double *restrict in, int w, rowstat *r){
+    __m256d mn = _mm256_set1_pd(INFINITY), mx = _mm256_set1_pd(-INFINITY);
+    ACCINIT();
+    size_t nnan = 0;
+    int x = 0;
+    for(; x + 8 <= w; x += 8){
+        __m256d lo = _mm256_loadu_pd(in + x), hi = _mm256_loadu_pd(in + x + 4);
+        __m256d oklo = _mm256_cmp_pd(lo, lo, _CMP_ORD_Q), okhi = _mm256_cmp_pd(hi, hi, _CMP_ORD_Q);
+        mn = _mm256_min_pd(lo, _mm256_min_pd(hi, mn));
+        mx = _mm256_max_pd(lo, _mm256_max_pd(hi, mx));
+        nnan += __builtin_popcount(~(_mm256_movemask_pd(oklo) | (_mm256_movemask_pd(okhi) << 4)) & 0xff);
+        lo = _mm256_and_pd(lo, oklo);
+        hi = _mm256_and_pd(hi, okhi);
+        ACC8(lo, hi);
     }
-    I->maxval = max;
-    I->minval = min;
+    double vmin = hmin_pd(mn), vmax = hmax_pd(mx);
+    ACCDONE();
+    for(; x < w; ++x){
+        double v = in[x];
+        if(v != v){ ++nnan; continue; }
+        if(v < vmin) vmin = v;
+        if(v > vmax) vmax = v;
+        r->sum += v; r->sum2 += v * v;
+    }
+    r->min = vmin; r->max = vmax;
+    r->npix = w - nnan; r->nsat = 0;
+}
+#undef ACC8
+#undef ACCINIT
+#undef ACCDONE
+#else
+// U32/F/D: double accumulators; `ok` - pixel `v` should be counted (not NaN), `sat` - it is saturated
+#define ROWSTATF(type, ok, sat) \
+static void rowstat_##type(const type *restrict in, int w, rowstat *r){ \
+    double mn = INFINITY, mx = -INFINITY, s = 0., s2 = 0.; \
+    size_t n = 0, nsat = 0; \
+    for(int x = 0; x < w; ++x){ \
+        type v = in[x]; \
+        if(!(ok)) continue; \
+        if(v < mn) mn = v; \
+        if(v > mx) mx = v; \
+        s += v; s2 += (double)v * v; \
+        ++n; nsat += (sat); \
+    } \
+    r->min = mn; r->max = mx; r->sum = s; r->sum2 = s2; \
+    r->npix = n; r->nsat = nsat; \
 }
+ROWSTATF(uint32_t, 1, v == UINT32_MAX)
+ROWSTATF(float, v == v, 0)
+ROWSTATF(double, v == v, 0)
+#undef ROWSTATF
+#endif
 
-// calculate extremal values of image data and store them in it
-void il_Image_minmax(il_Image *I){
-    if(!I || !I->data) return;
+ROWSTATI(uint8_t, UINT8_MAX)
+ROWSTATI(uint16_t, UINT16_MAX)
+#undef ROWSTATI
+
+// add row `y` statistics `r` to `st`; argmin/argmax are looked for only if extremum changed
+#define STATADD(type) do{ \
+    if(r.min < st->min){ \
+        int x = 0; \
+        while(row[x] != (type)r.min) ++x; \
+        st->min = r.min; st->argmin = (size_t)y * w + x; \
+    } \
+    if(r.max > st->max){ \
+        int x = 0; \
+        while(row[x] != (type)r.max) ++x; \
+        st->max = r.max; st->argmax = (size_t)y * w + x; \
+    } \
+    st->sum += r.sum; st->sum2 += r.sum2; st->npix += r.npix; st->nsat += r.nsat; \
+    }while(0)
+
+#define STATROWS(type) do{ \
+    _Pragma("omp parallel") \
+    { \
+        il_Stats loc = {.min = INFINITY, .max = -INFINITY}, *st = &loc; \
+        _Pragma("omp for nowait schedule(static)") \
+        for(int y = 0; y < h; ++y){ \
+            const type *row = IL_ROW(type, I, y); \
+            rowstat r; \
+            rowstat_##type(row, w, &r); \
+            STATADD(type); \
+        } \
+        _Pragma("omp critical") \
+        { \
+            if(loc.min < res.min || (loc.min == res.min && loc.argmin < res.argmin)){ \
+                res.min = loc.min; res.argmin = loc.argmin; \
+            } \
+            if(loc.max > res.max || (loc.max == res.max && loc.argmax < res.argmax)){ \
+                res.max = loc.max; res.argmax = loc.argmax; \
+            } \
+            res.sum += loc.sum; res.sum2 += loc.sum2; res.npix += loc.npix; res.nsat += loc.nsat; \
+        } \
+    }}while(0)
+
+/**
+ * @brief il_Image_stats - calculate (or get from cache) image statistics by single pass over data;
+ *          also stores min/max in image (as il_Image_minmax) and mean value (as il_Image_mean)
+ * @param I - image
+ * @param st (o) - statistics (or NULL if only cache should be filled)
+ * @return FALSE if error
+ */
+int il_Image_stats(il_Image *I, il_Stats *st){
+    if(!I || !I->data) return FALSE;
+    if(stat_cached(I, IL_STAT_STATS)){
+        if(st) *st = I->stat.stats;
+        return TRUE;
+    }
 #ifdef EBUG
     double t0 = dtime();
 #endif
+    int w = I->width, h = I->height;
+    il_Stats res = {.min = INFINITY, .max = -INFINITY, .argmin = SIZE_MAX, .argmax = SIZE_MAX};
     switch(I->type){
         case IMTYPE_U8:
-            u8minmax(I);
+            STATROWS(uint8_t);
         break;
         case IMTYPE_U16:
-            u16minmax(I);
+            STATROWS(uint16_t);
         break;
         case IMTYPE_U32:
-            u32minmax(I);
+            STATROWS(uint32_t);
         break;
         case IMTYPE_F:
-            fminmax(I);
+            STATROWS(float);
         break;
         case IMTYPE_D:
-            dminmax(I);
+            STATROWS(double);
         break;
         default:
-            return;
+            return FALSE;
+    }
+    if(res.npix == 0){ // all pixels are NaN
+        res.min = res.max = 0.;
+        res.argmin = res.argmax = 0;
     }
-    DBG("Image_minmax(): Min=%g, Max=%g, time: %gms", I->minval, I->maxval, (dtime()-t0)*1e3);
+    I->minval = res.min;
+    I->maxval = res.max;
+    I->stat.mean = res.npix ? res.sum / res.npix : 0.;
+    I->stat.stats = res;
+    I->stat.flags |= IL_STAT_MINMAX | IL_STAT_MEAN | IL_STAT_STATS;
+    if(st) *st = res;
+    DBG("Image_stats(): Min=%g, Max=%g, mean=%g, time: %gms", res.min, res.max, I->stat.mean, (dtime()-t0)*1e3);
+    return TRUE;
+}
+#undef STATADD
+#undef STATROWS
+
+// calculate extremal values of image data and store them in it (if they aren't in cache)
+void il_Image_minmax(il_Image *I){
+    if(!I || !I->data) return;
+    if(stat_cached(I, IL_STAT_MINMAX)) return;
+    il_Image_stats(I, NULL);
+}
+
+/**
+ * @brief il_Image_minmaxS - the same as il_Image_minmax but band by band (for mmap'ed images larger than RAM)
+ * @param I - image
+ * @param bandh - band height (rows) or 0 for IL_BANDHEIGHT
+ */
+void il_Image_minmaxS(il_Image *I, int bandh){
+    if(!I || !I->data) return;
+    if(stat_cached(I, IL_STAT_MINMAX)) return;
+    if(bandh < 1) bandh = IL_BANDHEIGHT;
+    double min = DBL_MAX, max = -DBL_MAX;
+    for(int y0 = 0; y0 < I->height; y0 += bandh){
+        il_ImageView V;
+        il_ImageView_set(&V, I, 0, y0, I->width, bandh);
+        il_Image_advise(I, y0 + bandh, bandh, IL_ADV_WILLNEED);
+        il_Stats st;
+        int ok = il_Image_stats(&V.I, &st);
+        il_Image_advise(I, y0, bandh, IL_ADV_DONTNEED);
+        if(!ok || st.npix == 0) continue; // all pixels of band are NaN
+        if(st.min < min) min = st.min;
+        if(st.max > max) max = st.max;
+    }
+    if(min > max) min = max = 0.; // all pixels are NaN
+    I->minval = min;
+    I->maxval = max;
+    I->stat.flags |= IL_STAT_MINMAX;
+}
+
+/**
+ * @brief il_Image_mean - mean value of image pixels (cached)
+ * @param I - image
+ * @return mean value
+ */
+double il_Image_mean(il_Image *I){
+    if(!I || !I->data) return 0.;
+    if(stat_cached(I, IL_STAT_MEAN)) return I->stat.mean;
+    il_Image_stats(I, NULL);
+    return I->stat.mean;
 }
 
 /*
@@ -689,7 +1081,7 @@ int il_write_png(const char *name, int w, int h, int ncolors, uint8_t *bytes){
     if(!bytes || !name || (ncolors != 1 && ncolors != 3) || w < 1 || h < 1) return FALSE;
     char *tmpnm = MALLOC(char, strlen(name) + 10);
     sprintf(tmpnm, "%s-tmp.jpg", name);
-    int r = stbi_write_png(tmpnm, w, h, ncolors, bytes, w);
+    int r = stbi_write_png(tmpnm, w, h, ncolors, bytes, w*ncolors);
     if(r){
         if(rename(tmpnm, name)){
             WARN("rename()");
@@ -700,6 +1092,37 @@ int il_write_png(const char *name, int w, int h, int ncolors, uint8_t *bytes){
     return r;
 }
 
+/**
+ * @brief il_Image_png - save 1-channel image as png (8-bit images are stored as is, others - after il_Image2u8)
+ * @param name - output file name
+ * @param I - image
+ * @return FALSE if failed
+ */
+int il_Image_png(const char *name, const il_Image *I){
+    if(!name || !I || !I->data || I->width < 1 || I->height < 1) return FALSE;
+    uint8_t *bytes = NULL;
+    int stride = (int)I->pitch;
+    if(I->type == IMTYPE_U8) bytes = (uint8_t*)I->data;
+    else{
+        il_Image tmp = *I; // il_Image2u8 will change minval/maxval
+        bytes = il_Image2u8(&tmp, 1);
+        if(!bytes) return FALSE;
+        stride = I->width;
+    }
+    char *tmpnm = MALLOC(char, strlen(name) + 10);
+    sprintf(tmpnm, "%s-tmp.png", name);
+    int r = stbi_write_png(tmpnm, I->width, I->height, 1, bytes, stride);
+    if(r){
+        if(rename(tmpnm, name)){
+            WARN("rename()");
+            r = FALSE;
+        }
+    }
+    FREE(tmpnm);
+    if(bytes != I->data) FREE(bytes);
+    return r;
+}
+
 /**
  * @brief il_Img3_png - save Img3 as jpeg
  * @param name - output file name
@@ -722,6 +1145,23 @@ int il_Img3_png(const char *name, il_Img3 *I3){
     return r;
 }
 
+// save planar image as jpeg (it is interleaved only here)
+int il_Img3p_jpg(const char *name, const il_Img3p *I, int quality){
+    il_Img3 *I3 = il_Img3p2Img3(I);
+    if(!I3) return FALSE;
+    int r = il_Img3_jpg(name, I3, quality);
+    il_Img3_free(&I3);
+    return r;
+}
+
+// save planar image as png (it is interleaved only here)
+int il_Img3p_png(const char *name, const il_Img3p *I){
+    il_Img3 *I3 = il_Img3p2Img3(I);
+    if(!I3) return FALSE;
+    int r = il_Img3_png(name, I3);
+    il_Img3_free(&I3);
+    return r;
+}
 
 /*
  * <=================== SAVE IMAGES ===========================
@@ -0,0 +1,231 @@
+/*
+ * This file is part of the improclib project.
+ * Copyright 2023 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// pool of image buffers for streaming processing (one pool per thread: it isn't thread-safe!)
+
+#include <usefull_macros.h>
+#include <string.h>
+
+#include "improclib.h"
+
+// kinds of pool buffers
+typedef enum{
+    PB_RAW,                 // raw memory block
+    PB_IMAGE,               // il_Image
+    PB_BINIMAGE             // il_BinImage
+} pbkind_t;
+
+// one buffer: image, binary image or raw memory block
+typedef struct poolbuf{
+    struct poolbuf *next;
+    pbkind_t kind;          // buffer kind
+    il_Image *img;          // image header (data == img->data) for PB_IMAGE
+    il_BinImage *bin;       // binary image header (data == bin->data) for PB_BINIMAGE
+    void *data;             // buffer data
+    size_t size;            // size of raw buffer
+} poolbuf;
+
+struct il_ImagePool{
+    poolbuf *free;          // buffers ready to use
+    poolbuf *lent;          // buffers given to user
+    int nfree;              // amount of buffers in `free`
+    int maxfree;            // max amount of free buffers to keep (<1 - unlimited)
+    size_t hits;            // amount of buffers taken from `free`
+    size_t misses;          // amount of buffers allocated
+};
+
+/**
+ * @brief il_ImagePool_new - create new pool of buffers
+ * @param maxfree - max amount of unused buffers kept by pool (if < 1 - unlimited)
+ * @return pool allocated here
+ */
+il_ImagePool *il_ImagePool_new(int maxfree){
+    il_ImagePool *p = MALLOC(il_ImagePool, 1);
+    p->maxfree = maxfree;
+    return p;
+}
+
+static void pb_free(poolbuf **b){
+    switch((*b)->kind){
+        case PB_IMAGE:
+            (*b)->img->pool = NULL;
+            il_Image_free(&(*b)->img);
+        break;
+        case PB_BINIMAGE:
+            (*b)->bin->pool = NULL;
+            il_BinImage_free(&(*b)->bin);
+        break;
+        default:
+            FREE((*b)->data);
+    }
+    FREE(*b);
+}
+
+/**
+ * @brief il_ImagePool_free - free pool and all its buffers (including lent!)
+ * @param p - pool
+ */
+void il_ImagePool_free(il_ImagePool **p){
+    if(!p || !*p) return;
+    poolbuf *lists[2] = {(*p)->free, (*p)->lent};
+    for(int i = 0; i < 2; ++i){
+        poolbuf *b = lists[i];
+        while(b){
+            poolbuf *nxt = b->next;
+            pb_free(&b);
+            b = nxt;
+        }
+    }
+    FREE(*p);
+}
+
+/**
+ * @brief il_ImagePool_stat - get pool statistics
+ * @param p - pool
+ * @param hits (o) - amount of buffers reused (or NULL)
+ * @param misses (o) - amount of buffers allocated (or NULL)
+ */
+void il_ImagePool_stat(const il_ImagePool *p, size_t *hits, size_t *misses){
+    if(!p) return;
+    if(hits) *hits = p->hits;
+    if(misses) *misses = p->misses;
+}
+
+// find free buffer with given parameters, move it into `lent` and return it
+static poolbuf *pb_get(il_ImagePool *p, pbkind_t kind, int w, int h, il_imtype_t type, size_t size){
+    poolbuf *b = p->free, *prev = NULL;
+    for(; b; prev = b, b = b->next){
+        if(b->kind != kind) continue;
+        switch(kind){
+            case PB_IMAGE:
+                if(b->img->width != w || b->img->height != h || b->img->type != type) continue;
+            break;
+            case PB_BINIMAGE:
+                if(b->bin->width != w || b->bin->height != h) continue;
+            break;
+            default:
+                if(b->size != size) continue;
+        }
+        if(prev) prev->next = b->next;
+        else p->free = b->next;
+        --p->nfree;
+        ++p->hits;
+        b->next = p->lent;
+        p->lent = b;
+        return b;
+    }
+    ++p->misses;
+    b = MALLOC(poolbuf, 1);
+    b->kind = kind;
+    b->next = p->lent;
+    p->lent = b;
+    return b;
+}
+
+/**
+ * @brief il_Image_newP - pool-aware il_Image_new(): get image from pool (or allocate new)
+ *          ATTENTION! Image data isn't cleared if image was reused!
+ * @param p - pool (if NULL - simply il_Image_new())
+ * @param w, h - image size
+ * @param type - pixel type
+ * @return image (free it by il_Image_free() to return into pool) or NULL if error
+ */
+il_Image *il_Image_newP(il_ImagePool *p, int w, int h, il_imtype_t type){
+    if(!p) return il_Image_new(w, h, type);
+    if(w < 1 || h < 1 || type >= IMTYPE_AMOUNT) return NULL;
+    poolbuf *b = pb_get(p, PB_IMAGE, w, h, type, 0);
+    if(!b->img){ // new image
+        b->img = il_Image_new(w, h, type);
+        b->img->pool = p;
+        b->data = b->img->data;
+    }else il_Image_modified(b->img); // invalidate cache
+    return b->img;
+}
+
+// pool-aware il_Image_sim()
+il_Image *il_Image_simP(il_ImagePool *p, const il_Image *i){
+    if(!i) return NULL;
+    return il_Image_newP(p, i->width, i->height, i->type);
+}
+
+/**
+ * @brief il_BinImage_newP - pool-aware il_BinImage_new()
+ *          ATTENTION! Image data isn't cleared if image was reused!
+ * @param p - pool (if NULL - simply il_BinImage_new())
+ * @param w, h - image size
+ * @return image (free it by il_BinImage_free() to return into pool) or NULL if error
+ */
+il_BinImage *il_BinImage_newP(il_ImagePool *p, int w, int h){
+    if(!p) return il_BinImage_new(w, h);
+    if(w < 1 || h < 1) return NULL;
+    poolbuf *b = pb_get(p, PB_BINIMAGE, w, h, IMTYPE_AMOUNT, 0);
+    if(!b->bin){
+        b->bin = il_BinImage_new(w, h);
+        b->bin->pool = p;
+        b->data = b->bin->data;
+    }
+    return b->bin;
+}
+
+/**
+ * @brief il_ImagePool_getbuf - get raw memory buffer from pool (or allocate new)
+ *          ATTENTION! Data isn't cleared if buffer was reused!
+ * @param p - pool (if NULL - allocate zero-filled buffer)
+ * @param size - buffer size (bytes)
+ * @return buffer (return it back with il_ImagePool_put()) aligned to IL_ALIGN
+ */
+void *il_ImagePool_getbuf(il_ImagePool *p, size_t size){
+    if(!size) return NULL;
+    if(!p) return il_alloc_rows(size, 1);
+    poolbuf *b = pb_get(p, PB_RAW, 0, 0, IMTYPE_AMOUNT, size);
+    if(!b->data){
+        b->data = il_alloc_rows(size, 1);
+        b->size = size;
+    }
+    return b->data;
+}
+
+/**
+ * @brief il_ImagePool_put - return buffer got by il_ImagePool_getbuf() (or image data) into pool
+ *          (if `data` isn't from this pool, it will be freed)
+ * @param p - pool (may be NULL)
+ * @param data - buffer
+ */
+void il_ImagePool_put(il_ImagePool *p, void *data){
+    if(!data) return;
+    if(!p){
+        free(data);
+        return;
+    }
+    poolbuf *b = p->lent, *prev = NULL;
+    for(; b; prev = b, b = b->next){
+        if(b->data != data) continue;
+        if(prev) prev->next = b->next;
+        else p->lent = b->next;
+        if(p->maxfree > 0 && p->nfree >= p->maxfree){
+            pb_free(&b);
+            return;
+        }
+        b->next = p->free;
+        p->free = b;
+        ++p->nfree;
+        return;
+    }
+    WARNX("il_ImagePool_put(): buffer isn't from this pool");
+    free(data);
+}
@@ -31,6 +31,14 @@ typedef struct{
     int height;     // height
 } il_Img3;
 
+// planar 3-channel image: each colour is separate plane of width*height bytes
+typedef struct{
+    uint8_t *data;      // memory block with all planes
+    uint8_t *plane[3];  // R, G and B planes (aligned to IL_ALIGN)
+    int width;          // width
+    int height;         // height
+} il_Img3p;
+
 // 1-channel image - pattern
 typedef struct{
     uint8_t *data;  // image data
@@ -47,16 +55,119 @@ typedef enum{
     IMTYPE_AMOUNT
 } il_imtype_t;
 
+// image rows allocated by il_Image_new() are aligned (and padded) to this amount of bytes
+#define IL_ALIGN        (64)
+
+// flags of il_AllocSetMode
+#define IL_ALLOC_FIRSTTOUCH (1<<0)  // zero rows in parallel by the same static row partition as kernels use (NUMA)
+#define IL_ALLOC_HUGEPAGES  (1<<1)  // use transparent huge pages for buffers >= 2MB
+
+// flags of valid fields in il_ImStat
+#define IL_STAT_MINMAX  (1<<0)
+#define IL_STAT_HISTO   (1<<1)
+#define IL_STAT_MEAN    (1<<2)
+#define IL_STAT_BKG     (1<<3)
+#define IL_STAT_STATS   (1<<4)
+#define IL_STAT_NOCACHE (1<<5)  // image never caches statistics (e.g. views of tiles: they have no parent)
+
+// image statistics by il_Image_stats()
 typedef struct{
+    double min;         // extremal values (NaNs are skipped)
+    double max;
+    double sum;         // sum of values
+    double sum2;        // sum of squared values
+    size_t argmin;      // index (y*width + x) of the first pixel with min/max value
+    size_t argmax;
+    size_t npix;        // amount of counted (not NaN) pixels
+    size_t nsat;        // amount of saturated pixels (having max value of integer type)
+} il_Stats;
+
+// cached image statistics: valid only while `stamp` is equal to image `modcnt`
+typedef struct{
+    size_t stamp;       // image `modcnt` when cache was filled
+    uint32_t flags;     // which fields are valid (IL_STAT_xx; minval/maxval are in image itself)
+    double mean;        // mean value
+    double bkg;         // background level by il_Image_background()
+    il_Stats stats;     // by il_Image_stats()
+    size_t *histogram;  // histogram of U8/U16 image (256/65536 bins)
+} il_ImStat;
+
+// pool of buffers for streaming processing (see imagepool.c)
+typedef struct il_ImagePool il_ImagePool;
+
+typedef struct il_Image{
     int width;			// width
     int height;			// height
     il_imtype_t type;    // data type
     int pixbytes;       // size of one pixel data (bytes)
     void *data;         // picture data
+    size_t pitch;       // bytes per row (>= width*pixbytes)
+    il_ImagePool *pool; // pool owning this image or NULL
+    void (*release)(void *data, void *ctx); // function to release external data (il_Image_wrap) or NULL
+    void *relctx;       // its context
+    struct il_Image *parent; // image owning data (for views) or NULL
+    size_t modcnt;      // data modification counter (call il_Image_modified() after direct data changes!)
+    il_ImStat stat;     // cached statistics
     double minval;      // extremal data values
     double maxval;
 } il_Image;
 
+// pointer to the first pixel of row `y` of image `I` with pixel type `type`
+#define IL_ROW(type, I, y)  ((type*)((uint8_t*)(I)->data + (size_t)(y)*(I)->pitch))
+
+// non-owning rectangular window over another image: pass &view.I to any il_Image function
+// (but never to il_Image_free!)
+typedef struct{
+    il_Image I;         // header: I.data points into parent data, I.pitch == parent->pitch
+    il_Image *parent;   // image owning pixel data
+    int x0;             // left upper corner of window on parent
+    int y0;
+} il_ImageView;
+
+// packed binary image: each row is `stride` 64-bit words, pixel x is bit (63 - x%64) of word x/64
+// (MSB is the leftmost pixel); bits after `width` in each row are always zero
+typedef struct{
+    int width;          // width (pixels)
+    int height;         // height
+    int stride;         // words per row (multiple of IL_ALIGN/8)
+    uint64_t *data;     // image data
+    il_ImagePool *pool; // pool owning this image or NULL
+    void (*release)(void *data, void *ctx); // function to release external data (il_BinImage_mmap) or NULL
+    void *relctx;       // its context
+} il_BinImage;
+
+// pointer to the first word of row `y` of binary image `B`
+#define IL_BINROW(B, y)     (&(B)->data[(size_t)(y)*(B)->stride])
+// value of pixel (x,y) of binary image `B`
+#define IL_BINPIX(B, x, y)  ((IL_BINROW(B, y)[(x) >> 6] >> (63 - ((x) & 63))) & 1)
+
+// tiled image: ntx x nty square tiles of tilesize x tilesize pixels, each tile is contiguous block
+// of `tilebytes` bytes (tile rows are tilesize*pixbytes bytes); tiles are stored row by row
+typedef struct{
+    int width;          // width of full frame
+    int height;         // height
+    il_imtype_t type;   // data type
+    int pixbytes;       // size of one pixel data (bytes)
+    int tilesize;       // tile side (pixels)
+    int ntx;            // amount of tiles by X
+    int nty;            // amount of tiles by Y
+    size_t tilebytes;   // size of one tile (aligned to IL_ALIGN)
+    void *data;         // tiles data
+} il_TiledImage;
+
+// amount of tiles in tiled image `T`
+#define IL_NTILES(T)    ((T)->ntx * (T)->nty)
+
+// modes of il_Image_mmap/il_BinImage_mmap
+#define IL_MMAP_RDONLY  (0)     // map existing file read-only
+#define IL_MMAP_RDWR    (1)     // map existing file for reading and writing
+#define IL_MMAP_CREATE  (2)     // create new zero-filled file (or truncate existing)
+// advices for il_Image_advise/il_BinImage_advise
+#define IL_ADV_WILLNEED (0)
+#define IL_ADV_DONTNEED (1)
+// default band height (rows) for streaming functions (xxS)
+#define IL_BANDHEIGHT   (256)
+
 // input file/directory type
 typedef enum{
     T_WRONG,
@@ -73,11 +184,28 @@ typedef enum{
 /*================================================================================*
  *                                converttypes.c                                  *
  *================================================================================*/
+// output kinds of il_bin2ImageT
+typedef enum{
+    IL_BIN_U8_255,      // U8 image with values 0 and 255 (for visualization)
+    IL_BIN_U8_1,        // U8 image with values 0 and 1
+    IL_BIN_U32          // U32 image with values 0 and 1 (for labeling)
+} il_binout_t;
+
 il_Image *il_u82Image(const uint8_t *data, int width, int height);
+il_Image *il_u82ImageP(il_ImagePool *p, const uint8_t *data, int width, int height);
 uint8_t *il_Image2u8(il_Image *I, int nchannels);
-il_Image *il_bin2Image(const uint8_t *image, int W, int H);
-uint8_t *il_Image2bin(const il_Image *im, double bk);
-size_t *il_bin2sizet(const uint8_t *image, int W, int H);
+il_Image *il_bin2Image(const il_BinImage *B);
+il_Image *il_bin2ImageP(il_ImagePool *p, const il_BinImage *B);
+il_Image *il_bin2ImageT(const il_BinImage *B, il_binout_t out);
+il_Image *il_bin2ImageTP(il_ImagePool *p, const il_BinImage *B, il_binout_t out);
+il_BinImage *il_Image2bin(const il_Image *im, double bk);
+il_BinImage *il_Image2binP(il_ImagePool *p, const il_Image *im, double bk);
+int il_Image2binS(const il_Image *im, double bk, il_BinImage *out, int bandh);
+size_t *il_bin2sizet(const il_BinImage *B);
+size_t *il_bin2sizetP(il_ImagePool *p, const il_BinImage *B);
+il_Image *il_Image_convert(const il_Image *src, il_imtype_t type, double scale, double offset);
+il_Image *il_Image_convertP(il_ImagePool *p, const il_Image *src, il_imtype_t type, double scale, double offset);
+int il_Image_convert_inplace(il_Image *I, il_imtype_t type, double scale, double offset);
 
 /*================================================================================*
  *                                   draw.c                                       *
@@ -88,6 +216,12 @@ il_Pattern *il_Pattern_new(int w, int h);
 void il_Pattern_free(il_Pattern **I);
 il_Img3 *il_Img3_new(int w, int h);
 void il_Img3_free(il_Img3 **I3);
+il_Img3p *il_Img3p_new(int w, int h);
+void il_Img3p_free(il_Img3p **I);
+int il_Img3_deinterleave(const il_Img3 *I, il_Img3p *P);
+int il_Img3p_interleave(const il_Img3p *P, il_Img3 *I);
+il_Img3 *il_Img3p2Img3(const il_Img3p *P);
+il_Img3p *il_Img32Img3p(const il_Img3 *I);
 
 il_Pattern *il_Pattern_cross(int w, int h);
 il_Pattern *il_Pattern_xcross(int w, int h);
@@ -102,6 +236,9 @@ void il_Image_drawcircle(il_Image *I, int x0, int y0, int R, const void *val);
 void il_Img3_drawpattern(il_Img3 *img, const il_Pattern *p, int xc, int yc, const uint8_t color[3]);
 void il_Img3_setcolor(uint8_t impixel[3], const uint8_t color[3]);
 void il_Img3_drawpix(il_Img3 *img, int x, int y, const uint8_t color[3]);
+void il_Img3p_drawpattern(il_Img3p *img, const il_Pattern *p, int xc, int yc, const uint8_t color[3]);
+void il_Img3p_setcolor(il_Img3p *I, size_t idx, const uint8_t color[3]);
+void il_Img3p_drawpix(il_Img3p *I, int x, int y, const uint8_t color[3]);
 void il_Img3_drawline(il_Img3 *img, int x0, int y0, int x1, int y1, const uint8_t color[3]);
 void il_Img3_drawcircle(il_Img3 *I, int x0, int y0, int R, const uint8_t color[3]);
 void il_Img3_drawgrid(il_Img3 *img, int x0, int y0, int xstep, int ystep, const uint8_t color[3]);
@@ -112,7 +249,14 @@ il_Img3 *il_Img3_subimage(const il_Img3 *I, int x0, int y0, int x1, int y1);
  *                                 imagefile.c                                    *
  *================================================================================*/
 int il_getpixbytes(il_imtype_t type);
+size_t il_getpitch(int w, il_imtype_t type);
+int il_AllocSetMode(int mode);
+void *il_alloc_rows(size_t pitch, int h);
+void il_Image_modified(il_Image *I);
 void il_Image_minmax(il_Image *I);
+int il_Image_stats(il_Image *I, il_Stats *st);
+void il_Image_minmaxS(il_Image *I, int bandh);
+double il_Image_mean(il_Image *I);
 uint8_t *il_equalize8(il_Image *I, int nchannels, double throwpart);
 uint8_t *il_equalize16(il_Image *I, int nchannels, double throwpart);
 
@@ -120,10 +264,14 @@ il_InputType il_chkinput(const char *name);
 il_Image *il_Image_read(const char *name);
 il_Image *il_Image_new(int w, int h, il_imtype_t type);
 il_Image *il_Image_sim(const il_Image *i);
+il_Image *il_Image_wrap(void *data, int w, int h, il_imtype_t type, size_t pitch,
+                        void (*release)(void *data, void *ctx), void *ctx);
+int il_ImageView_set(il_ImageView *V, il_Image *parent, int x0, int y0, int w, int h);
 void il_Image_free(il_Image **I);
 
 size_t *il_histogram8(const il_Image *I);
 size_t *il_histogram16(const il_Image *I);
+size_t *il_histogramS(il_Image *I, int bandh);
 int il_Image_background(il_Image *img, double *bkg);
 
 il_Img3 *il_Img3_read(const char *name);
@@ -131,6 +279,171 @@ int il_Img3_jpg(const char *name, il_Img3 *I3, int quality);
 int il_Img3_png(const char *name, il_Img3 *I3);
 int il_write_jpg(const char *name, int w, int h, int ncolors, uint8_t *bytes, int quality);
 int il_write_png(const char *name, int w, int h, int ncolors, uint8_t *bytes);
+int il_Image_png(const char *name, const il_Image *I);
+int il_Img3p_jpg(const char *name, const il_Img3p *I, int quality);
+int il_Img3p_png(const char *name, const il_Img3p *I);
+
+/*================================================================================*
+ *                                 imagepool.c                                    *
+ *================================================================================*/
+il_ImagePool *il_ImagePool_new(int maxfree);
+void il_ImagePool_free(il_ImagePool **p);
+void il_ImagePool_stat(const il_ImagePool *p, size_t *hits, size_t *misses);
+il_Image *il_Image_newP(il_ImagePool *p, int w, int h, il_imtype_t type);
+il_Image *il_Image_simP(il_ImagePool *p, const il_Image *i);
+il_BinImage *il_BinImage_newP(il_ImagePool *p, int w, int h);
+void *il_ImagePool_getbuf(il_ImagePool *p, size_t size);
+void il_ImagePool_put(il_ImagePool *p, void *data);
+
+/*================================================================================*
+ *                                 mmapimage.c                                    *
+ *================================================================================*/
+il_Image *il_Image_mmap(const char *name, int w, int h, il_imtype_t type, size_t offset, int mode);
+il_BinImage *il_BinImage_mmap(const char *name, int w, int h, int mode);
+void il_Image_advise(const il_Image *I, int y0, int h, int advice);
+void il_BinImage_advise(const il_BinImage *B, int y0, int h, int advice);
+
+/*================================================================================*
+ *                                   tiled.c                                      *
+ *================================================================================*/
+il_TiledImage *il_TiledImage_new(int w, int h, il_imtype_t type, int tilesize);
+void il_TiledImage_free(il_TiledImage **T);
+int il_TiledImage_tile(const il_TiledImage *T, int n, il_ImageView *V);
+il_TiledImage *il_Image2tiled(const il_Image *I, int tilesize);
+il_Image *il_tiled2Image(const il_TiledImage *T);
+int il_TiledImage_minmax(const il_TiledImage *T, double *min, double *max);
+
+/*================================================================================*
+ *                                 histogram.c                                    *
+ *================================================================================*/
+// histogram with `nbins` equal bins over [min, max]
+typedef struct{
+    int nbins;          // amount of bins
+    double min;         // lower edge of the first bin
+    double max;         // upper edge of the last bin (values equal to `max` are counted in it)
+    size_t *bins;       // counts
+    size_t under;       // amount of values less than `min`
+    size_t over;        // amount of values greater than `max`
+} il_Histogram;
+
+il_Histogram *il_Image_histogram(const il_Image *I, int nbins, double min, double max);
+il_Histogram *il_Image_histogramW(const il_Image *I, double binw, double min, double max);
+int il_Histogram_fill(il_Histogram *H, const il_Image *I);
+void il_Histogram_free(il_Histogram **H);
+size_t *il_TiledImage_histogram(const il_TiledImage *T);
+int il_Image_percentiles(const il_Image *I, int n, const double *q, double *val);
+int il_Image_median(const il_Image *I, double *med);
+int il_Image_mad(const il_Image *I, double *med, double *mad);
+double il_qselect(double *a, size_t n, size_t k);
+
+/*================================================================================*
+ *                                 sigmaclip.c                                    *
+ *================================================================================*/
+// sigma-clipped statistics
+typedef struct{
+    double mean;        // mean of values left after clipping
+    double median;      // their median
+    double std;         // their standard deviation (noise)
+    size_t npix;        // their amount
+    int niter;          // amount of clipping iterations made
+} il_ClipStats;
+
+int il_sigmaclip(double *a, size_t n, double nsigma, int maxiter, il_ClipStats *st);
+int il_Image_sigmaclip(const il_Image *I, double nsigma, int maxiter, il_ClipStats *st);
+
+/*================================================================================*
+ *                                 integral.c                                     *
+ *================================================================================*/
+// integral image: tables of (width+1) x (height+1) elements, element (x, y) is sum over pixels [0, x) x [0, y);
+// integer images have integer sums, float/double images - double
+typedef struct{
+    int width;          // size of image
+    int height;
+    size_t stride;      // elements per row of tables
+    il_imtype_t type;   // type of image
+    uint64_t *isum;     // U8/U16/U32: sum of values
+    uint64_t *isum2;    // U8/U16: sum of squares (or NULL)
+    void *wsum2;        // U32: sum of squares (unsigned __int128, or NULL)
+    double *dsum;       // F/D: sum of values
+    double *dsum2;      // F/D: sum of squares (or NULL)
+} il_Integral;
+
+il_Integral *il_Image_integral(const il_Image *I, int sq);
+void il_Integral_free(il_Integral **S);
+size_t il_Integral_box(const il_Integral *S, int x0, int y0, int x1, int y1, double *sum, double *sum2);
+int il_Integral_meanvar_row(const il_Integral *S, int r, int y, float *mean, float *var, double *buf);
+il_Image *il_Integral_boxfilter(const il_Integral *S, int r, il_Image **var);
+il_Image *il_Image_boxmean(const il_Image *I, int r, il_Image **var);
+
+/*================================================================================*
+ *                                 adaptive.c                                     *
+ *================================================================================*/
+// local thresholds of il_Image2binAdapt by mean m and standard deviation s in window
+typedef enum{
+    IL_ADAPT_MEAN,      // m + k
+    IL_ADAPT_NIBLACK,   // m + k*s (k > 0 for bright objects)
+    IL_ADAPT_SAUVOLA,   // m*(1 + k*(s/R - 1)) (k < 0 for bright objects on dark background)
+    IL_ADAPT_AMOUNT
+} il_adapt_t;
+
+il_BinImage *il_Image2binAdapt(const il_Image *I, il_adapt_t method, int r, double k, double R);
+il_BinImage *il_Image2binAdaptP(il_ImagePool *p, const il_Image *I, il_adapt_t method, int r, double k, double R);
+
+/*================================================================================*
+ *                                 threshold.c                                    *
+ *================================================================================*/
+// automatic global thresholds of il_Image_threshold
+typedef enum{
+    IL_THRESH_OTSU,     // max of between-class variance
+    IL_THRESH_TRIANGLE, // max distance below line from histogram peak to the end of its longer tail
+    IL_THRESH_AMOUNT
+} il_thresh_t;
+
+int il_histo_otsu(const size_t *histo, int nbins, int *thr);
+int il_histo_triangle(const size_t *histo, int nbins, int *thr);
+int il_histo_multiotsu(const size_t *histo, int nbins, int nclasses, int *thr);
+int il_Image_threshold(const il_Image *I, il_thresh_t method, double *thr);
+int il_Image_multithreshold(const il_Image *I, int nclasses, double *thr);
+
+/*================================================================================*
+ *                                   bkgmap.c                                     *
+ *================================================================================*/
+// background map: clipped background level and RMS in square cells, interpolated between cell centers
+// by bicubic (natural) splines
+typedef struct{
+    int width;          // size of image
+    int height;
+    int meshsize;       // cell side (pixels)
+    int nx;             // amount of cells by X
+    int ny;             // amount of cells by Y
+    float *bkg;         // background in cells (nx*ny, row by row)
+    float *rms;         // RMS in cells
+    float *d2bkg;       // second derivatives of splines by Y for each column of cells (internal)
+    float *d2rms;
+} il_BkgMap;
+
+il_BkgMap *il_Image_bkgmap(const il_Image *I, int meshsize, int filtersize);
+void il_BkgMap_free(il_BkgMap **B);
+int il_BkgMap_row(const il_BkgMap *B, int y, float *bkg, float *rms);
+il_Image *il_BkgMap_image(const il_BkgMap *B, int rms);
+il_Image *il_Image_subbkg(const il_Image *I, const il_BkgMap *B);
+il_BinImage *il_Image2binBkg(const il_Image *I, const il_BkgMap *B, double nsigma);
+
+/*================================================================================*
+ *                                  stretch.c                                     *
+ *================================================================================*/
+// transfer functions of il_stretch (t is value normalized to [0, 1])
+typedef enum{
+    IL_STRETCH_LINEAR,  // t
+    IL_STRETCH_SQRT,    // sqrt(t)
+    IL_STRETCH_LOG,     // log(1 + a*t) / log(1 + a)
+    IL_STRETCH_ASINH,   // asinh(t/b) / asinh(1/b)
+    IL_STRETCH_GAMMA,   // t^(1/gamma)
+    IL_STRETCH_AMOUNT
+} il_stretch_t;
+
+int il_zscale(const il_Image *I, int nsamples, double contrast, double *z1, double *z2);
+uint8_t *il_stretch(const il_Image *I, int nchannels, il_stretch_t type, double param, double lo, double hi);
 
 /*================================================================================*
  *                                letters.c                                       *
@@ -150,6 +463,7 @@ int il_PoissonSetStep(double s);
 int il_Poisson(double lambda);
 void il_Image_addPoisson(il_Image *I, double lambda);
 void il_Img3_addPoisson(il_Img3 *I, double lambda);
+void il_Img3p_addPoisson(il_Img3p *I, double lambda);
 
 /*================================================================================*
  *                                    binmorph.c                                  *
@@ -172,26 +486,42 @@ typedef struct{
     il_Box *boxes;
 } il_ConnComps;
 
+int il_getbinstride(int w);
+il_BinImage *il_BinImage_new(int w, int h);
+il_BinImage *il_BinImage_sim(const il_BinImage *B);
+void il_BinImage_free(il_BinImage **B);
+
 // morphological operations:
-uint8_t *il_dilation(const uint8_t *image, int W, int H);
-uint8_t *il_dilationN(const uint8_t *image, int W, int H, int N);
-uint8_t *il_erosion(const uint8_t *image, int W, int H);
-uint8_t *il_erosionN(const uint8_t *image, int W, int H, int N);
-uint8_t *il_openingN(uint8_t *image, int W, int H, int N);
-uint8_t *il_closingN(uint8_t *image, int W, int H, int N);
-uint8_t *il_topHat(uint8_t *image, int W, int H, int N);
-uint8_t *il_botHat(uint8_t *image, int W, int H, int N);
+il_BinImage *il_dilation(const il_BinImage *B);
+il_BinImage *il_dilationN(const il_BinImage *B, int N);
+il_BinImage *il_erosion(const il_BinImage *B);
+il_BinImage *il_erosionN(const il_BinImage *B, int N);
+il_BinImage *il_openingN(const il_BinImage *B, int N);
+il_BinImage *il_closingN(const il_BinImage *B, int N);
+// the same with images from pool (return result by il_BinImage_free())
+il_BinImage *il_dilationP(il_ImagePool *p, const il_BinImage *B);
+il_BinImage *il_dilationNP(il_ImagePool *p, const il_BinImage *B, int N);
+il_BinImage *il_erosionP(il_ImagePool *p, const il_BinImage *B);
+il_BinImage *il_erosionNP(il_ImagePool *p, const il_BinImage *B, int N);
+il_BinImage *il_openingNP(il_ImagePool *p, const il_BinImage *B, int N);
+il_BinImage *il_closingNP(il_ImagePool *p, const il_BinImage *B, int N);
+il_BinImage *il_topHat(const il_BinImage *B, int N);
+il_BinImage *il_botHat(const il_BinImage *B, int N);
+// band-streaming versions for mmap'ed images: output `out` should be allocated by user
+int il_dilationS(const il_BinImage *in, il_BinImage *out, int bandh);
+int il_erosionS(const il_BinImage *in, il_BinImage *out, int bandh);
 
 // logical operations
-uint8_t *il_imand(uint8_t *im1, uint8_t *im2, int W, int H);
-uint8_t *il_substim(uint8_t *im1, uint8_t *im2, int W, int H);
+il_BinImage *il_imand(const il_BinImage *im1, const il_BinImage *im2);
+il_BinImage *il_substim(const il_BinImage *im1, const il_BinImage *im2);
 
 // clear non 4-connected pixels
-uint8_t *il_filter4(uint8_t *image, int W, int H);
+il_BinImage *il_filter4(const il_BinImage *B);
 // clear single pixels
-uint8_t *il_filter8(uint8_t *image, int W, int H);
+il_BinImage *il_filter8(const il_BinImage *B);
 
-size_t *il_CClabel4(uint8_t *Img, int W, int H, il_ConnComps **CC);
+size_t *il_CClabel4(const il_BinImage *B, il_ConnComps **CC);
+size_t *il_CClabel4P(il_ImagePool *p, const il_BinImage *B, il_ConnComps **CC);
 //size_t *il_cclabel8(uint8_t *Img, int W, int H, size_t *Nobj);
 
 /*================================================================================*
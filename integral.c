@@ -0,0 +1,276 @@
+/*
+ * This file is part of the improclib project.
+ * Copyright 2023 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Integral images (summed-area tables) and box filters with constant cost per pixel. Tables are built in two
+ * parallel passes: prefix sums of each row (threads by rows), then cumulative sums of rows (threads by strips
+ * of columns). Integer images have integer tables: even if they overflow, box sums (differences of four
+ * elements) are exact modulo 2^64 (2^128 for squares of U32), i.e. exact while they fit in 64 (128) bits.
+ */
+
+#include <usefull_macros.h>
+#include <string.h>
+
+#include "improclib.h"
+#include "openmp.h"
+
+typedef unsigned __int128 u128;
+
+// columns in strip of vertical pass
+#define ISTRIP      (256)
+
+// row prefix sums of image row `y` into table rows: `sum` of `stype`, `sum2` of `qtype` (or NULL)
+#define ROWSUM(type, stype, sum, qtype, sum2) do{ \
+    OMP_FOR(schedule(static)) \
+    for(int y = 0; y < h; ++y){ \
+        const type *in = IL_ROW(type, I, y); \
+        stype *s = sum + (size_t)(y + 1) * stride + 1, acc = 0; \
+        for(int x = 0; x < w; ++x){ \
+            acc += (stype)in[x]; \
+            s[x] = acc; \
+        } \
+        if(!sum2) continue; \
+        qtype *q = sum2 + (size_t)(y + 1) * stride + 1, qacc = 0; \
+        for(int x = 0; x < w; ++x){ \
+            qtype v = (qtype)in[x]; \
+            qacc += v * v; \
+            q[x] = qacc; \
+        } \
+    }}while(0)
+
+// cumulative sums of table rows
+#define COLSUM(stype, sum) do{ \
+    OMP_FOR(schedule(static)) \
+    for(int x0 = 1; x0 <= w; x0 += ISTRIP){ \
+        int x1 = (x0 + ISTRIP <= w + 1) ? x0 + ISTRIP : w + 1; \
+        for(int y = 2; y <= h; ++y){ \
+            stype *restrict cur = sum + (size_t)y * stride; \
+            const stype *restrict prev = cur - stride; \
+            for(int x = x0; x < x1; ++x) cur[x] += prev[x]; \
+        } \
+    }}while(0)
+
+/**
+ * @brief il_Image_integral - build integral image: table element (x, y) is sum of pixels [0, x) x [0, y)
+ *          (tables are (width+1) x (height+1), the first row and column are zero); NaNs aren't allowed
+ * @param I - image
+ * @param sq - TRUE to build table of squares too (for variance)
+ * @return integral image allocated here (free it by il_Integral_free()) or NULL if error
+ */
+il_Integral *il_Image_integral(const il_Image *I, int sq){
+    if(!I || !I->data || I->type >= IMTYPE_AMOUNT) return NULL;
+    int w = I->width, h = I->height;
+    size_t stride = (size_t)w + 1, N = stride * (h + 1);
+    il_Integral *S = MALLOC(il_Integral, 1);
+    S->width = w; S->height = h;
+    S->stride = stride;
+    S->type = I->type;
+    switch(I->type){
+        case IMTYPE_U8:
+            S->isum = MALLOC(uint64_t, N);
+            if(sq) S->isum2 = MALLOC(uint64_t, N);
+            ROWSUM(uint8_t, uint64_t, S->isum, uint64_t, S->isum2);
+        break;
+        case IMTYPE_U16:
+            S->isum = MALLOC(uint64_t, N);
+            if(sq) S->isum2 = MALLOC(uint64_t, N);
+            ROWSUM(uint16_t, uint64_t, S->isum, uint64_t, S->isum2);
+        break;
+        case IMTYPE_U32: // squares could overflow 64 bits even in small box
+            S->isum = MALLOC(uint64_t, N);
+            if(sq) S->wsum2 = MALLOC(u128, N);
+            ROWSUM(uint32_t, uint64_t, S->isum, u128, (u128*)S->wsum2);
+        break;
+        case IMTYPE_F:
+            S->dsum = MALLOC(double, N);
+            if(sq) S->dsum2 = MALLOC(double, N);
+            ROWSUM(float, double, S->dsum, double, S->dsum2);
+        break;
+        default:
+            S->dsum = MALLOC(double, N);
+            if(sq) S->dsum2 = MALLOC(double, N);
+            ROWSUM(double, double, S->dsum, double, S->dsum2);
+    }
+    if(S->isum) COLSUM(uint64_t, S->isum);
+    if(S->isum2) COLSUM(uint64_t, S->isum2);
+    if(S->dsum) COLSUM(double, S->dsum);
+    if(S->dsum2) COLSUM(double, S->dsum2);
+    if(S->wsum2) COLSUM(u128, (u128*)S->wsum2);
+    return S;
+}
+#undef ROWSUM
+#undef COLSUM
+
+void il_Integral_free(il_Integral **S){
+    if(!S || !*S) return;
+    FREE((*S)->isum);
+    FREE((*S)->isum2);
+    FREE((*S)->dsum);
+    FREE((*S)->dsum2);
+    FREE((*S)->wsum2);
+    FREE(*S);
+}
+
+// integral image has table of squares
+#define HASSQ(S)    ((S)->isum2 || (S)->dsum2 || (S)->wsum2)
+
+// sum over box [x0, x1) x [y0, y1) by table `t`
+#define BOXSUM(t, x0, y0, x1, y1) \
+    ((t)[(size_t)(y1)*stride + (x1)] - (t)[(size_t)(y0)*stride + (x1)] - (t)[(size_t)(y1)*stride + (x0)] + (t)[(size_t)(y0)*stride + (x0)])
+
+/**
+ * @brief il_Integral_box - sums over box [x0, x1) x [y0, y1) (it's cut by image borders)
+ * @param S - integral image
+ * @param x0, y0, x1, y1 - box
+ * @param sum (o) - sum of values (or NULL)
+ * @param sum2 (o) - sum of squared values (or NULL; FALSE is returned if there's no table of squares)
+ * @return amount of pixels in box or 0 if box is empty or error
+ */
+size_t il_Integral_box(const il_Integral *S, int x0, int y0, int x1, int y1, double *sum, double *sum2){
+    if(!S) return 0;
+    if(sum2 && !HASSQ(S)) return 0;
+    if(x0 < 0) x0 = 0;
+    if(y0 < 0) y0 = 0;
+    if(x1 > S->width) x1 = S->width;
+    if(y1 > S->height) y1 = S->height;
+    if(x1 <= x0 || y1 <= y0) return 0;
+    size_t stride = S->stride;
+    if(sum) *sum = S->isum ? (double)BOXSUM(S->isum, x0, y0, x1, y1) : BOXSUM(S->dsum, x0, y0, x1, y1);
+    if(sum2){
+        if(S->isum2) *sum2 = (double)BOXSUM(S->isum2, x0, y0, x1, y1);
+        else if(S->wsum2) *sum2 = (double)BOXSUM((const u128*)S->wsum2, x0, y0, x1, y1);
+        else *sum2 = BOXSUM(S->dsum2, x0, y0, x1, y1);
+    }
+    return (size_t)(x1 - x0) * (y1 - y0);
+}
+
+// sums over boxes [x - r, x + r] x [y0, y1) of all pixels of row into `out` (interior pixels are calculated
+// without clamping)
+#define ROWBOX(type, t, out) do{ \
+    const type *restrict b = (const type*)(t) + (size_t)y0 * stride, *restrict e = (const type*)(t) + (size_t)y1 * stride; \
+    int xl = (r < w) ? r : w, xr = (w - r - 1 > xl) ? w - r - 1 : xl; \
+    for(int x = 0; x < xl; ++x){ \
+        int x1 = (x + r < w) ? x + r + 1 : w; \
+        out[x] = (e[x1] - b[x1]) - (e[0] - b[0]); \
+    } \
+    for(int x = xl; x < xr; ++x) \
+        out[x] = (e[x+r+1] - b[x+r+1]) - (e[x-r] - b[x-r]); \
+    for(int x = xr; x < w; ++x){ \
+        int x0 = (x > r) ? x - r : 0; \
+        out[x] = (e[w] - b[w]) - (e[x0] - b[x0]); \
+    }}while(0)
+
+/**
+ * @brief il_Integral_meanvar_row - local mean and variance over square window (2r+1)x(2r+1) (cut by image borders)
+ *          for all pixels of one row (variance of integer images is calculated exactly as (n*sum2 - sum^2)/n^2)
+ * @param S - integral image
+ * @param r - window radius
+ * @param y - row
+ * @param mean (o) - mean values (S->width values)
+ * @param var (o) - variances (or NULL; FALSE is returned if there's no table of squares)
+ * @param buf - buffer for 3*S->width doubles (allocated by MALLOC)
+ * @return FALSE if error
+ */
+int il_Integral_meanvar_row(const il_Integral *S, int r, int y, float *mean, float *var, double *buf){
+    if(!S || r < 0 || y < 0 || y >= S->height || !mean || !buf) return FALSE;
+    if(var && !HASSQ(S)) return FALSE;
+    int w = S->width;
+    size_t stride = S->stride;
+    int y0 = (y > r) ? y - r : 0, y1 = (y + r < S->height) ? y + r + 1 : S->height, ny = y1 - y0;
+    if(S->isum){
+        uint64_t *s = (uint64_t*)(buf + 2 * (size_t)w);
+        u128 *q = (u128*)buf;
+        ROWBOX(uint64_t, S->isum, s);
+        if(var){
+            if(S->isum2) ROWBOX(uint64_t, S->isum2, q);
+            else ROWBOX(u128, S->wsum2, q);
+        }
+        for(int x = 0; x < w; ++x){
+            int x0 = (x > r) ? x - r : 0, x1 = (x + r < w) ? x + r + 1 : w;
+            uint64_t n = (uint64_t)(x1 - x0) * ny;
+            mean[x] = (float)((double)s[x] / n);
+            if(var) var[x] = (float)((double)((u128)n * q[x] - (u128)s[x] * s[x]) / ((double)n * n));
+        }
+    }else{
+        double *s = buf + 2 * (size_t)w, *q = buf;
+        ROWBOX(double, S->dsum, s);
+        if(var) ROWBOX(double, S->dsum2, q);
+        for(int x = 0; x < w; ++x){
+            int x0 = (x > r) ? x - r : 0, x1 = (x + r < w) ? x + r + 1 : w;
+            double n = (double)(x1 - x0) * ny, m = s[x] / n;
+            mean[x] = (float)m;
+            if(var){
+                double v = q[x] / n - m * m;
+                var[x] = (float)((v > 0.) ? v : 0.);
+            }
+        }
+    }
+    return TRUE;
+}
+#undef ROWBOX
+#undef BOXSUM
+
+/**
+ * @brief il_Integral_boxfilter - local mean (and variance) over square window (2r+1)x(2r+1) (cut by image borders)
+ * @param S - integral image
+ * @param r - window radius
+ * @param var (o) - if not NULL, here will be image of local variances (S should have table of squares)
+ * @return float image of local means allocated here or NULL if error
+ */
+il_Image *il_Integral_boxfilter(const il_Integral *S, int r, il_Image **var){
+    if(!S || r < 0) return NULL;
+    if(var && !HASSQ(S)){
+        WARNX("il_Integral_boxfilter(): no table of squares");
+        return NULL;
+    }
+    int w = S->width, h = S->height;
+    il_Image *M = il_Image_new(w, h, IMTYPE_F), *V = NULL;
+    if(!M) return NULL;
+    if(var){
+        V = il_Image_new(w, h, IMTYPE_F);
+        if(!V){
+            il_Image_free(&M);
+            return NULL;
+        }
+    }
+#pragma omp parallel
+{
+    double *buf = MALLOC(double, 3 * (size_t)w);
+    #pragma omp for schedule(static)
+    for(int y = 0; y < h; ++y)
+        il_Integral_meanvar_row(S, r, y, IL_ROW(float, M, y), V ? IL_ROW(float, V, y) : NULL, buf);
+    FREE(buf);
+}
+    if(var) *var = V;
+    return M;
+}
+
+/**
+ * @brief il_Image_boxmean - local mean over square window (2r+1)x(2r+1) with constant cost per pixel
+ * @param I - image
+ * @param r - window radius
+ * @param var (o) - if not NULL, here will be image of local variances
+ * @return float image allocated here or NULL if error
+ */
+il_Image *il_Image_boxmean(const il_Image *I, int r, il_Image **var){
+    il_Integral *S = il_Image_integral(I, var != NULL);
+    if(!S) return NULL;
+    il_Image *M = il_Integral_boxfilter(S, r, var);
+    il_Integral_free(&S);
+    return M;
+}
@@ -124,7 +124,7 @@ static const uint8_t letters[95][13] = {
 
 #define PUTL(type, max) \
     for(int cury = y; cury > y-13; --cury, ++letter){ if(cury >= I->height) continue; if(cury < 0) break; \
-        type *data = &((type*)I->data)[I->width * cury + x]; \
+        type *data = IL_ROW(type, I, cury) + x; \
         uint8_t l = *letter; \
         for(int curx = x; curx < x+8; ++curx, ++data, l <<= 1){ if(curx >= I->width) break; if(curx < 0) continue; \
             if(l & 0x80){ *data = max; \
@@ -178,6 +178,7 @@ int il_Image_putstring(il_Image *I, const char *str, int x, int y){
         ++str;
         x += 9;
     }
+    il_Image_modified(I);
     return TRUE;
 }
 
@@ -199,7 +200,7 @@ int il_Img3_putstring(il_Img3 *I, const char *str, int x, int y, const uint8_t c
         if(x > I->width) break;
         const uint8_t *letter = letters[c];
         for(int cury = y; cury > y-13; --cury, ++letter){ if(cury >= I->height) continue; if(cury < 0) break;
-            uint8_t *data = &((uint8_t*)I->data)[3 * (I->width * cury + x)];
+            uint8_t *data = &((uint8_t*)I->data)[3 * ((size_t)I->width * cury + x)];
             uint8_t l = *letter;
             for(int curx = x; curx < x+8; ++curx, data+=3, l <<= 1){ if(curx >= I->width) break; if(curx < 0) continue;
                 if(l & 0x80){ // foreground - set to it given color or its negative
@@ -0,0 +1,169 @@
+/*
+ * This file is part of the improclib project.
+ * Copyright 2023 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// file-backed (mmap'ed) images for frames larger than RAM
+
+#include <usefull_macros.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "improclib.h"
+
+// context of mapped file
+typedef struct{
+    void *addr;     // mapping start (page aligned)
+    size_t len;     // mapping length
+} mapctx;
+
+static void unmap(void *data, void *ctx){
+    (void)data;
+    mapctx *m = (mapctx*)ctx;
+    munmap(m->addr, m->len);
+    FREE(m);
+}
+
+/**
+ * @brief mapfile - map `size` bytes of file `name` starting from `offset`
+ * @param name - file name
+ * @param offset - offset of data in file (any, not only page-aligned)
+ * @param size - data size
+ * @param mode - IL_MMAP_xx
+ * @param ctx (o) - context for `unmap`
+ * @return pointer to data or NULL if error
+ */
+static void *mapfile(const char *name, size_t offset, size_t size, int mode, mapctx **ctx){
+    if(!name || !size) return NULL;
+    int oflags = (mode == IL_MMAP_RDONLY) ? O_RDONLY : O_RDWR;
+    if(mode == IL_MMAP_CREATE) oflags |= O_CREAT | O_TRUNC;
+    int fd = open(name, oflags, 0644);
+    if(fd < 0){
+        WARN("Can't open %s", name);
+        return NULL;
+    }
+    size_t need = offset + size;
+    if(mode == IL_MMAP_CREATE){
+        if(ftruncate(fd, (off_t)need)){ // new file is filled by zeros
+            WARN("ftruncate()");
+            close(fd);
+            return NULL;
+        }
+    }else{
+        struct stat st;
+        if(fstat(fd, &st) || (size_t)st.st_size < need){
+            WARNX("File %s is too small: need %zd bytes", name, need);
+            close(fd);
+            return NULL;
+        }
+    }
+    size_t pgsz = (size_t)sysconf(_SC_PAGESIZE), shift = offset % pgsz;
+    int prot = (mode == IL_MMAP_RDONLY) ? PROT_READ : PROT_READ | PROT_WRITE;
+    void *addr = mmap(NULL, size + shift, prot, MAP_SHARED, fd, (off_t)(offset - shift));
+    close(fd); // mapping keeps its own reference
+    if(addr == MAP_FAILED){
+        WARN("mmap()");
+        return NULL;
+    }
+    madvise(addr, size + shift, MADV_SEQUENTIAL); // all functions walk images row by row
+    *ctx = MALLOC(mapctx, 1);
+    (*ctx)->addr = addr;
+    (*ctx)->len = size + shift;
+    return (uint8_t*)addr + shift;
+}
+
+/**
+ * @brief il_Image_mmap - make image over raw pixel file (rows of w*pixbytes bytes without gaps)
+ *          il_Image_free() unmaps file; with IL_MMAP_RDONLY image data can't be changed!
+ * @param name - file name
+ * @param w, h - image size
+ * @param type - pixel type
+ * @param offset - offset of first pixel in file (e.g. header size)
+ * @param mode - IL_MMAP_RDONLY, IL_MMAP_RDWR or IL_MMAP_CREATE (create or truncate file and fill it by zeros)
+ * @return image or NULL if error
+ */
+il_Image *il_Image_mmap(const char *name, int w, int h, il_imtype_t type, size_t offset, int mode){
+    if(w < 1 || h < 1 || type >= IMTYPE_AMOUNT) return NULL;
+    size_t pitch = (size_t)w * il_getpixbytes(type);
+    mapctx *ctx = NULL;
+    void *data = mapfile(name, offset, pitch * h, mode, &ctx);
+    if(!data) return NULL;
+    il_Image *I = il_Image_wrap(data, w, h, type, pitch, unmap, ctx);
+    if(!I) unmap(data, ctx);
+    return I;
+}
+
+/**
+ * @brief il_BinImage_mmap - make binary image over raw file (rows of il_getbinstride(w) 64-bit words)
+ * @param name - file name
+ * @param w, h - image size
+ * @param mode - IL_MMAP_xx (the same as for il_Image_mmap)
+ * @return image or NULL if error
+ */
+il_BinImage *il_BinImage_mmap(const char *name, int w, int h, int mode){
+    if(w < 1 || h < 1) return NULL;
+    int stride = il_getbinstride(w);
+    mapctx *ctx = NULL;
+    void *data = mapfile(name, 0, (size_t)stride * sizeof(uint64_t) * h, mode, &ctx);
+    if(!data) return NULL;
+    il_BinImage *B = MALLOC(il_BinImage, 1);
+    B->width = w;
+    B->height = h;
+    B->stride = stride;
+    B->data = data;
+    B->release = unmap;
+    B->relctx = ctx;
+    return B;
+}
+
+// advise kernel about rows [y0, y0+h) of mapped area with rows of `pitch` bytes
+static void advise(void *data, size_t pitch, int y0, int h, int advice){
+    size_t pgsz = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)data + (size_t)y0 * pitch, end = start + (size_t)h * pitch;
+    start -= start % pgsz;
+    madvise((void*)start, end - start, (advice == IL_ADV_DONTNEED) ? MADV_DONTNEED : MADV_WILLNEED);
+}
+
+/**
+ * @brief il_Image_advise - for streaming processing of mmap'ed images: tell kernel that rows [y0, y0+h)
+ *          will be needed soon (IL_ADV_WILLNEED) or aren't needed any more (IL_ADV_DONTNEED);
+ *          does nothing for images in RAM
+ * @param I - image (or view over mmap'ed image)
+ * @param y0 - first row
+ * @param h - amount of rows
+ * @param advice - IL_ADV_xx
+ */
+void il_Image_advise(const il_Image *I, int y0, int h, int advice){
+    if(!I || !I->data) return;
+    const il_Image *owner = I;
+    while(owner->parent) owner = owner->parent;
+    if(owner->release != unmap) return;
+    if(y0 < 0){ h += y0; y0 = 0; }
+    if(y0 + h > I->height) h = I->height - y0;
+    if(h < 1) return;
+    advise(I->data, I->pitch, y0, h, advice);
+}
+
+// the same as il_Image_advise but for binary images
+void il_BinImage_advise(const il_BinImage *B, int y0, int h, int advice){
+    if(!B || !B->data || B->release != unmap) return;
+    if(y0 < 0){ h += y0; y0 = 0; }
+    if(y0 + h > B->height) h = B->height - y0;
+    if(h < 1) return;
+    advise(B->data, (size_t)B->stride * sizeof(uint64_t), y0, h, advice);
+}
@@ -28,7 +28,13 @@
         #endif
         #define OMP_FOR(x) _Pragma(Stringify(omp parallel for x))
     #endif
+    #define OMP_MAX_THREADS()   omp_get_max_threads()
+    #define OMP_NUM_THREADS()   omp_get_num_threads()
+    #define OMP_THREAD_NUM()    omp_get_thread_num()
 #else
     #define OMP_FOR(x)
+    #define OMP_MAX_THREADS()   (1)
+    #define OMP_NUM_THREADS()   (1)
+    #define OMP_THREAD_NUM()    (0)
 #endif
 
@@ -90,17 +90,21 @@ int il_Poisson(double lambda){
 }
 
 #define ADDPU(type, max) \
-    type *d = (type*)I->data; \
-    int wh = I->width * I->height; \
-    for(int i = 0; i < wh; ++i, ++d){ \
-        type res = *d + il_Poisson(lambda); \
-        *d = (res >= *d) ? res : max; \
+    int w = I->width, h = I->height; \
+    for(int y = 0; y < h; ++y){ \
+        type *d = IL_ROW(type, I, y); \
+        for(int x = 0; x < w; ++x, ++d){ \
+            type res = *d + il_Poisson(lambda); \
+            *d = (res >= *d) ? res : max; \
+        } \
     }
 #define ADDPF(type) \
-    type *d = (type*)I->data; \
-    int wh = I->width * I->height; \
-    for(int i = 0; i < wh; ++i, ++d){ \
-        *d += il_Poisson(lambda); \
+    int w = I->width, h = I->height; \
+    for(int y = 0; y < h; ++y){ \
+        type *d = IL_ROW(type, I, y); \
+        for(int x = 0; x < w; ++x, ++d){ \
+            *d += il_Poisson(lambda); \
+        } \
     }
 static void add8p(il_Image *I, double lambda){
     ADDPU(uint8_t, 0xff);
@@ -125,31 +129,32 @@ static void adddp(il_Image *I, double lambda){
 void il_Image_addPoisson(il_Image *I, double lambda){
     switch(I->type){
         case IMTYPE_U8:
-            return add8p(I, lambda);
+            add8p(I, lambda);
         break;
         case IMTYPE_U16:
-            return add16p(I, lambda);
+            add16p(I, lambda);
         break;
         case IMTYPE_U32:
-            return add32p(I, lambda);
+            add32p(I, lambda);
         break;
         case IMTYPE_F:
-            return addfp(I, lambda);
+            addfp(I, lambda);
         break;
         case IMTYPE_D:
-            return adddp(I, lambda);
+            adddp(I, lambda);
         break;
         default:
             ERRX("ilImage_addPoisson(): invalid data type");
     }
+    il_Image_modified(I);
 }
 
 // the same as il_Image_addPoisson but for coloured image (add same noice to all three pixel colour components)
 void il_Img3_addPoisson(il_Img3 *I, double lambda){
-    int wh = I->width * I->height * 3;
+    size_t wh = (size_t)I->width * I->height * 3;
     uint8_t *id = (uint8_t*)I->data;
     //OMP_FOR() - only will be more slowly
-    for(int i = 0; i < wh; i += 3){
+    for(size_t i = 0; i < wh; i += 3){
         uint8_t n = il_Poisson(lambda), *d = &id[i];
         for(int j = 0; j < 3; ++j){
             uint8_t newval = d[j] + n;
@@ -157,3 +162,21 @@ void il_Img3_addPoisson(il_Img3 *I, double lambda){
         }
     }
 }
+
+// the same as il_Img3_addPoisson but for planar image
+void il_Img3p_addPoisson(il_Img3p *I, double lambda){
+    int w = I->width, h = I->height;
+    uint8_t *noice = MALLOC(uint8_t, w);
+    for(int y = 0; y < h; ++y){
+        for(int x = 0; x < w; ++x) noice[x] = il_Poisson(lambda); // generator is serial
+        size_t idx = (size_t)y * w;
+        for(int c = 0; c < 3; ++c){ // saturated add: vectorized by compiler
+            uint8_t *restrict d = I->plane[c] + idx;
+            for(int x = 0; x < w; ++x){
+                uint8_t newval = d[x] + noice[x];
+                d[x] = (newval >= d[x]) ? newval : 255;
+            }
+        }
+    }
+    FREE(noice);
+}
@@ -0,0 +1,203 @@
+/*
+ * This file is part of the improclib project.
+ * Copyright 2023 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Iterative sigma-clipped statistics: values outside median +- nsigma*std are rejected until nothing changes.
+ * Image is read only once: integer images with less than 65536 different values are clipped by histogram
+ * (each iteration is O(bins)), others - by buffer of non-NaN values compacted after each iteration.
+ */
+
+#include <usefull_macros.h>
+#include <math.h>
+#include <string.h>
+
+#include "improclib.h"
+#include "openmp.h"
+
+// median of `n` values (array is reordered)
+static double buf_median(double *a, size_t n){
+    double m = il_qselect(a, n, n / 2);
+    if(!(n & 1)){ // lower middle value is max of left part
+        double l = a[0];
+        for(size_t i = 1; i < n / 2; ++i) if(a[i] > l) l = a[i];
+        m = 0.5 * (m + l);
+    }
+    return m;
+}
+
+/**
+ * @brief il_sigmaclip - sigma-clipped statistics of array
+ * @param a - values without NaNs (array is reordered and compacted: the first st->npix values are left after clipping)
+ * @param n - their amount
+ * @param nsigma - clipping threshold (in std units)
+ * @param maxiter - max amount of clipping iterations (0 - until convergence)
+ * @param st (o) - statistics of values left
+ * @return FALSE if error
+ */
+int il_sigmaclip(double *a, size_t n, double nsigma, int maxiter, il_ClipStats *st){
+    if(!a || n < 1 || !(nsigma > 0.) || !st) return FALSE;
+    int iter = 0;
+    double med, mean, std;
+    for(;;){
+        med = buf_median(a, n);
+        double s = 0., s2 = 0.;
+        for(size_t i = 0; i < n; ++i) s += a[i];
+        mean = s / n;
+        for(size_t i = 0; i < n; ++i){
+            double d = a[i] - mean;
+            s2 += d * d;
+        }
+        std = sqrt(s2 / n);
+        if((maxiter > 0 && iter == maxiter) || std == 0.) break;
+        double lo = med - nsigma * std, hi = med + nsigma * std;
+        size_t m = 0;
+        for(size_t i = 0; i < n; ++i) if(a[i] >= lo && a[i] <= hi) a[m++] = a[i];
+        if(m == n || m == 0) break; // m == 0 only if median is between two values farther than nsigma*std
+        n = m;
+        ++iter;
+    }
+    st->mean = mean;
+    st->median = med;
+    st->std = std;
+    st->npix = n;
+    st->niter = iter;
+    return TRUE;
+}
+
+// sigma clipping by histogram `H` with bin width 1 (bin `b` has value H->min + b)
+static void hist_clip(const il_Histogram *H, double nsigma, int maxiter, il_ClipStats *st){
+    const size_t *c = H->bins;
+    int b0 = 0, b1 = H->nbins - 1, iter = 0;
+    double vmin = H->min, med, mean, std;
+    size_t n;
+    for(;;){
+        double s = 0.;
+        n = 0;
+        for(int b = b0; b <= b1; ++b){
+            n += c[b];
+            s += (double)c[b] * b;
+        }
+        mean = s / n;
+        double s2 = 0.;
+        for(int b = b0; b <= b1; ++b){
+            double d = b - mean;
+            s2 += c[b] * d * d;
+        }
+        std = sqrt(s2 / n);
+        // median: (n-1)/2-th and n/2-th values
+        size_t r0 = (n - 1) / 2, r1 = n / 2, cum = 0;
+        int m0 = -1, m1 = -1;
+        for(int b = b0; b <= b1 && m1 < 0; ++b){
+            cum += c[b];
+            if(m0 < 0 && cum > r0) m0 = b;
+            if(cum > r1) m1 = b;
+        }
+        med = 0.5 * (m0 + m1);
+        if((maxiter > 0 && iter == maxiter) || std == 0.) break;
+        // bins of values in [med - nsigma*std, med + nsigma*std]
+        double lo = ceil(med - nsigma * std), hi = floor(med + nsigma * std);
+        int nb0 = (lo > b0) ? (int)lo : b0, nb1 = (hi < b1) ? (int)hi : b1;
+        while(nb0 < nb1 && !c[nb0]) ++nb0;
+        while(nb1 > nb0 && !c[nb1]) --nb1;
+        size_t left = 0;
+        for(int b = nb0; b <= nb1; ++b) left += c[b];
+        if(left == n || left == 0) break;
+        b0 = nb0; b1 = nb1;
+        ++iter;
+    }
+    st->mean = mean + vmin;
+    st->median = med + vmin;
+    st->std = std;
+    st->npix = n;
+    st->niter = iter;
+}
+
+// copy non-NaN values of image rows into buffer: each row into its own part, then they are compacted
+#define GETVALS(type) do{ \
+    OMP_FOR(schedule(static)) \
+    for(int y = 0; y < h; ++y){ \
+        const type *in = IL_ROW(type, I, y); \
+        double *out = a + (size_t)y * w; \
+        int n = 0; \
+        for(int x = 0; x < w; ++x){ \
+            double v = (double)in[x]; \
+            out[n] = v; \
+            n += (v == v); \
+        } \
+        cnt[y] = n; \
+    }}while(0)
+
+/**
+ * @brief il_Image_sigmaclip - sigma-clipped statistics of non-NaN pixels
+ * @param I - image
+ * @param nsigma - clipping threshold (in std units)
+ * @param maxiter - max amount of clipping iterations (0 - until convergence)
+ * @param st (o) - statistics of pixels left after clipping, st->niter - amount of iterations made
+ * @return FALSE if error
+ */
+int il_Image_sigmaclip(const il_Image *I, double nsigma, int maxiter, il_ClipStats *st){
+    if(!I || !I->data || I->type >= IMTYPE_AMOUNT || !(nsigma > 0.) || !st) return FALSE;
+    int byhisto = (I->type == IMTYPE_U8 || I->type == IMTYPE_U16);
+    if(I->type == IMTYPE_U32){ // cache is the only thing we could change here
+        il_Image_minmax((il_Image*)I);
+        byhisto = (I->maxval - I->minval < 65536.);
+    }
+    if(byhisto){ // one bin per value (cached for U8/U16)
+        il_Histogram *H, HN;
+        if(I->type == IMTYPE_U32) H = il_Image_histogram(I, 0, 0., 0.);
+        else{
+            int nbins = (I->type == IMTYPE_U8) ? 256 : 65536;
+            HN = (il_Histogram){.nbins = nbins, .min = 0., .max = nbins,
+                .bins = (nbins == 256) ? il_histogram8(I) : il_histogram16(I)};
+            H = HN.bins ? &HN : NULL;
+        }
+        if(!H) return FALSE;
+        hist_clip(H, nsigma, maxiter, st);
+        if(H == &HN) FREE(HN.bins);
+        else il_Histogram_free(&H);
+        return TRUE;
+    }
+    int w = I->width, h = I->height;
+    double *a = MALLOC(double, (size_t)w * h);
+    int *cnt = MALLOC(int, h);
+    switch(I->type){
+        case IMTYPE_U32:
+            GETVALS(uint32_t);
+        break;
+        case IMTYPE_F:
+            GETVALS(float);
+        break;
+        default:
+            GETVALS(double);
+    }
+    size_t n = cnt[0];
+    for(int y = 1; y < h; ++y){
+        if(cnt[y] && n != (size_t)y * w) memmove(a + n, a + (size_t)y * w, cnt[y] * sizeof(double));
+        n += cnt[y];
+    }
+    FREE(cnt);
+    if(n == 0){
+        WARNX("il_Image_sigmaclip(): all pixels are NaN");
+        FREE(a);
+        return FALSE;
+    }
+    int ret = il_sigmaclip(a, n, nsigma, maxiter, st);
+    FREE(a);
+    return ret;
+}
+#undef GETVALS
@@ -0,0 +1,301 @@
+/*
+ * This file is part of the improclib project.
+ * Copyright 2023 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// non-linear display stretches (8-bit output) and zscale limits
+
+#include <usefull_macros.h>
+#include <math.h>
+#include <string.h>
+
+#include "improclib.h"
+#include "openmp.h"
+
+// zscale parameters (the same as in IRAF)
+#define ZS_NSAMPLES     (1000)  // default amount of samples
+#define ZS_CONTRAST     (0.25)  // default contrast
+#define ZS_MAXREJECT    (0.5)   // max part of rejected samples
+#define ZS_MINPIX       (5)     // min amount of good samples
+#define ZS_KREJ         (2.5)   // rejection threshold (sigmas)
+#define ZS_MAXITER      (5)     // max amount of fitting iterations
+#define ZS_NGROW        (1)     // neighbours of rejected sample to reject too
+
+// U32, float and double values are quantized to this amount of levels before table lookup
+#define NLEVELS         (65536)
+
+static int cmpdbl(const void *a, const void *b){
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+#define SAMPLE(type) \
+    for(int y = step/2; y < h; y += step){ \
+        const type *row = IL_ROW(type, I, y); \
+        for(int x = step/2; x < w; x += step){ \
+            double v = (double)row[x]; \
+            if(isfinite(v)) s[n++] = v; \
+        } \
+    }
+
+// get finite pixel values from regular grid with `step` pixels between nodes
+static int sample(const il_Image *I, int step, double *s){
+    int w = I->width, h = I->height, n = 0;
+    switch(I->type){
+        case IMTYPE_U8:
+            SAMPLE(uint8_t);
+        break;
+        case IMTYPE_U16:
+            SAMPLE(uint16_t);
+        break;
+        case IMTYPE_U32:
+            SAMPLE(uint32_t);
+        break;
+        case IMTYPE_F:
+            SAMPLE(float);
+        break;
+        case IMTYPE_D:
+            SAMPLE(double);
+        break;
+        default:
+            break;
+    }
+    return n;
+}
+#undef SAMPLE
+
+/**
+ * @brief il_zscale - IRAF-style display limits: line is fitted (with iterative sigma-rejection) to sorted
+ *          subsample of pixel values, its slope divided by `contrast` gives range around median
+ * @param I - image
+ * @param nsamples - approximate amount of pixels to sample (0 - default 1000)
+ * @param contrast - contrast (0 - default 0.25)
+ * @param z1, z2 (o) - lower and upper limits
+ * @return FALSE if error
+ */
+int il_zscale(const il_Image *I, int nsamples, double contrast, double *z1, double *z2){
+    if(!I || !I->data || !z1 || !z2) return FALSE;
+    if(nsamples < 1) nsamples = ZS_NSAMPLES;
+    if(contrast <= 0.) contrast = ZS_CONTRAST;
+    int w = I->width, h = I->height;
+    int step = (int)ceil(sqrt((double)w * h / nsamples));
+    if(step < 1) step = 1;
+    double *s = MALLOC(double, (size_t)(w / step + 1) * (h / step + 1));
+    int npix = sample(I, step, s);
+    if(npix < 1){
+        WARNX("il_zscale(): no finite pixels");
+        FREE(s);
+        return FALSE;
+    }
+    qsort(s, npix, sizeof(double), cmpdbl);
+    double zmin = s[0], zmax = s[npix - 1];
+    int center = (npix - 1) / 2;
+    double median = (npix & 1) ? s[center] : 0.5 * (s[center] + s[center + 1]);
+    int minpix = (int)(npix * ZS_MAXREJECT);
+    if(minpix < ZS_MINPIX) minpix = ZS_MINPIX;
+    uint8_t *bad = MALLOC(uint8_t, npix);
+    int ngood = npix, lastngood = npix + 1;
+    double slope = 0., icpt = 0.;
+    for(int iter = 0; iter < ZS_MAXITER && ngood < lastngood && ngood >= minpix; ++iter){
+        // least squares by good samples: s[i] = icpt + slope*i
+        double sx = 0., sy = 0., sxx = 0., sxy = 0.;
+        for(int i = 0; i < npix; ++i){
+            if(bad[i]) continue;
+            sx += i; sy += s[i]; sxx += (double)i * i; sxy += i * s[i];
+        }
+        double D = ngood * sxx - sx * sx;
+        if(D <= 0.) break;
+        slope = (ngood * sxy - sx * sy) / D;
+        icpt = (sy - slope * sx) / ngood;
+        double ss = 0.;
+        for(int i = 0; i < npix; ++i){
+            if(bad[i]) continue;
+            double r = s[i] - icpt - slope * i;
+            ss += r * r;
+        }
+        double thres = ZS_KREJ * sqrt(ss / ngood);
+        for(int i = 0; i < npix; ++i){
+            if(fabs(s[i] - icpt - slope * i) <= thres) continue;
+            int i0 = (i < ZS_NGROW) ? 0 : i - ZS_NGROW, i1 = (i + ZS_NGROW >= npix) ? npix - 1 : i + ZS_NGROW;
+            for(int j = i0; j <= i1; ++j) bad[j] = 1;
+        }
+        lastngood = ngood;
+        ngood = 0;
+        for(int i = 0; i < npix; ++i) if(!bad[i]) ++ngood;
+    }
+    *z1 = zmin; *z2 = zmax;
+    if(ngood >= minpix){
+        slope /= contrast;
+        double l = median - center * slope, r = median + (npix - 1 - center) * slope; // center is 0-based
+        if(l > zmin) *z1 = l;
+        if(r < zmax) *z2 = r;
+    }
+    DBG("zscale: %d samples, %d good, z1=%g, z2=%g", npix, ngood, *z1, *z2);
+    FREE(bad);
+    FREE(s);
+    return TRUE;
+}
+
+/**
+ * @brief fill_lut - fill table of output levels
+ * @param lut - table
+ * @param n - its size
+ * @param a, b - level `i` corresponds to normalized value t = a*i + b (0 is black, 1 is white)
+ * @param type - stretch type
+ * @param param - its parameter
+ */
+static void fill_lut(uint8_t *lut, int n, double a, double b, il_stretch_t type, double param){
+    double norm = 1.;
+    if(type == IL_STRETCH_LOG) norm = log1p(param);
+    else if(type == IL_STRETCH_ASINH) norm = asinh(1. / param);
+    for(int i = 0; i < n; ++i){
+        double t = a * i + b, f;
+        if(t < 0.) t = 0.;
+        else if(t > 1.) t = 1.;
+        switch(type){
+            case IL_STRETCH_SQRT:
+                f = sqrt(t);
+            break;
+            case IL_STRETCH_LOG:
+                f = log1p(param * t) / norm;
+            break;
+            case IL_STRETCH_ASINH:
+                f = asinh(t / param) / norm;
+            break;
+            case IL_STRETCH_GAMMA:
+                f = pow(t, 1. / param);
+            break;
+            default:
+                f = t;
+        }
+        lut[i] = (uint8_t)(255. * f + 0.5);
+    }
+}
+
+// level number for value `t` scaled to [0, NLEVELS-1] (NaN gives 0): sequential clamps and one conversion are
+// vectorized by compiler (unlike fmaxf/fminf without -ffast-math); double values are scaled in double and
+// clamped in single precision
+static inline uint16_t qlevelf(float t){
+    t += 0.5f;
+    t = (t > 0.f) ? t : 0.f;
+    t = (t < (float)(NLEVELS - 1)) ? t : (float)(NLEVELS - 1);
+    return (uint16_t)(int)t;
+}
+static inline uint16_t qleveld(double t){
+    return qlevelf((float)t);
+}
+
+// table lookup for one row: 3-channel output gets the same level in all channels
+#define LOOKUP(idx) do{ \
+    if(nchannels == 3) for(int x = 0; x < width; ++x) \
+        Out[3*x] = Out[3*x+1] = Out[3*x+2] = lut[idx[x]]; \
+    else for(int x = 0; x < width; ++x) Out[x] = lut[idx[x]]; \
+    }while(0)
+
+// U8/U16: pixel value is index of `lut`
+#define STRETCHI(datatype) do{ \
+    OMP_FOR(schedule(static)) \
+    for(int y = 0; y < height; ++y){ \
+        uint8_t *restrict Out = &outp[(size_t)y * stride]; \
+        const datatype *restrict In = IL_ROW(datatype, I, y); \
+        LOOKUP(In); \
+    }}while(0)
+
+// U32/F/D: levels of row are calculated (vectorized) into buffer, then they are looked up;
+// `level` is level of pixel `p`
+#define STRETCHQ(datatype, level) do{ \
+    _Pragma("omp parallel") \
+    { \
+        uint16_t *restrict L = MALLOC(uint16_t, width); \
+        _Pragma("omp for schedule(static)") \
+        for(int y = 0; y < height; ++y){ \
+            uint8_t *restrict Out = &outp[(size_t)y * stride]; \
+            const datatype *restrict In = IL_ROW(datatype, I, y); \
+            for(int x = 0; x < width; ++x){ \
+                datatype p = In[x]; \
+                L[x] = (uint16_t)(level); \
+            } \
+            LOOKUP(L); \
+        } \
+        FREE(L); \
+    }}while(0)
+
+/**
+ * @brief il_stretch - make 8-bit image for display by non-linear stretch of values in [lo, hi]
+ *          U8 and U16 pixels are converted by table of all values; U32, float and double pixels are
+ *          scaled to 16-bit level (in single precision for float) and converted by table of levels
+ * @param I - input image
+ * @param nchannels - 1 or 3 colour channels
+ * @param type - stretch type
+ * @param param - its parameter (0 - default): IL_STRETCH_LOG - a in log(1+a*t)/log(1+a) (1000),
+ *          IL_STRETCH_ASINH - softening b in asinh(t/b)/asinh(1/b) (0.1), IL_STRETCH_GAMMA - gamma in t^(1/gamma) (2.2)
+ * @param lo, hi - black and white levels (if lo >= hi they are calculated by il_zscale() with default parameters)
+ * @return allocated here image for jpeg/png storing or NULL if error
+ */
+uint8_t *il_stretch(const il_Image *I, int nchannels, il_stretch_t type, double param, double lo, double hi){
+    if(!I || !I->data || (nchannels != 1 && nchannels != 3) || type >= IL_STRETCH_AMOUNT) return NULL;
+    if(lo >= hi && !il_zscale(I, 0, 0., &lo, &hi)) return NULL;
+    if(param <= 0.) switch(type){
+        case IL_STRETCH_LOG:
+            param = 1000.;
+        break;
+        case IL_STRETCH_ASINH:
+            param = 0.1;
+        break;
+        case IL_STRETCH_GAMMA:
+            param = 2.2;
+        break;
+        default:
+            break;
+    }
+    int width = I->width, height = I->height;
+    size_t stride = (size_t)width * nchannels;
+    double k = (hi > lo) ? 1. / (hi - lo) : 0.; // flat image will be black
+    uint8_t *lut = MALLOC(uint8_t, NLEVELS);
+    uint8_t *outp = MALLOC(uint8_t, height * stride);
+    double q = k * (NLEVELS - 1);
+    float qf = (float)q, lof = (float)lo;
+    switch(I->type){
+        case IMTYPE_U8:
+            fill_lut(lut, 256, k, -lo * k, type, param);
+            STRETCHI(uint8_t);
+        break;
+        case IMTYPE_U16:
+            fill_lut(lut, 65536, k, -lo * k, type, param);
+            STRETCHI(uint16_t);
+        break;
+        case IMTYPE_U32:
+            fill_lut(lut, NLEVELS, 1. / (NLEVELS - 1), 0., type, param);
+            STRETCHQ(uint32_t, qleveld(((double)p - lo) * q));
+        break;
+        case IMTYPE_F:
+            fill_lut(lut, NLEVELS, 1. / (NLEVELS - 1), 0., type, param);
+            STRETCHQ(float, qlevelf((p - lof) * qf));
+        break;
+        case IMTYPE_D:
+            fill_lut(lut, NLEVELS, 1. / (NLEVELS - 1), 0., type, param);
+            STRETCHQ(double, qleveld((p - lo) * q));
+        break;
+        default:
+            WARNX("il_stretch(): unsupported image type %d", I->type);
+            FREE(outp);
+    }
+    FREE(lut);
+    return outp;
+}
+#undef LOOKUP
+#undef STRETCHI
+#undef STRETCHQ
@@ -0,0 +1,262 @@
+/*
+ * This file is part of the improclib project.
+ * Copyright 2023 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Global thresholds by histogram (Otsu, triangle, multi-level Otsu): no pixel passes except building of
+ * histogram (cached for U8/U16). Threshold `t` is bin number: class 0 is bins [0, t], class 1 - bins (t, nbins).
+ * Only the range of non-empty bins is processed.
+ * Otsu maximizes between-class variance, which (for bins of equal width) is the same as maximizing sum of
+ * S_k^2/N_k over classes (N_k - amount of pixels in class, S_k - sum of their bin numbers): for two classes
+ * it's one pass by prefix sums. Multi-level Otsu uses dynamic programming over class borders: O(nclasses*bins^2),
+ * so large histograms are at first merged into MOTSU_NBINS bins, and found borders are refined by original bins.
+ */
+
+#include <usefull_macros.h>
+#include <math.h>
+
+#include "improclib.h"
+
+// max amount of bins for dynamic programming of multi-level Otsu
+#define MOTSU_NBINS     (1024)
+
+// range of non-empty bins [*lo, *hi]; return FALSE if there's less than two of them
+static int nonempty(const size_t *histo, int nbins, int *lo, int *hi){
+    int l = 0, h = nbins - 1;
+    while(l < nbins && !histo[l]) ++l;
+    while(h > l && !histo[h]) --h;
+    if(h <= l) return FALSE;
+    *lo = l; *hi = h;
+    return TRUE;
+}
+
+// prefix sums of `n` bins: N[j] - amount of pixels in bins [0, j), S[j] - sum of their bin numbers
+static void prefix(const size_t *histo, int n, double *N, double *S){
+    N[0] = S[0] = 0.;
+    for(int b = 0; b < n; ++b){
+        N[b+1] = N[b] + (double)histo[b];
+        S[b+1] = S[b] + (double)histo[b] * b;
+    }
+}
+
+// S^2/N of class of bins [i, j)
+static inline double classval(const double *N, const double *S, int i, int j){
+    double n = N[j] - N[i], s = S[j] - S[i];
+    return (n > 0.) ? s * s / n : 0.;
+}
+
+/**
+ * @brief il_histo_otsu - Otsu threshold (max of between-class variance)
+ * @param histo - histogram (e.g. by il_histogram8/il_histogram16)
+ * @param nbins - its size
+ * @param thr (o) - threshold bin: class 0 is bins [0, thr]
+ * @return FALSE if error (e.g. less than two non-empty bins)
+ */
+int il_histo_otsu(const size_t *histo, int nbins, int *thr){
+    int lo, hi;
+    if(!histo || nbins < 2 || !thr || !nonempty(histo, nbins, &lo, &hi)) return FALSE;
+    const size_t *h = histo + lo;
+    int n = hi - lo + 1;
+    double *N = MALLOC(double, n + 1), *S = MALLOC(double, n + 1);
+    prefix(h, n, N, S);
+    double best = -1.;
+    int t = 0;
+    for(int j = 1; j < n; ++j){
+        double v = classval(N, S, 0, j) + classval(N, S, j, n);
+        if(v > best){
+            best = v;
+            t = j - 1;
+        }
+    }
+    FREE(N); FREE(S);
+    *thr = lo + t;
+    return TRUE;
+}
+
+/**
+ * @brief il_histo_triangle - triangle threshold: bin farthest below the line from histogram peak to the end
+ *          of its longer tail (good for a narrow background peak with a long tail of objects)
+ * @param histo - histogram (e.g. by il_histogram8/il_histogram16)
+ * @param nbins - its size
+ * @param thr (o) - threshold bin: class 0 is bins [0, thr]
+ * @return FALSE if error (e.g. less than two non-empty bins)
+ */
+int il_histo_triangle(const size_t *histo, int nbins, int *thr){
+    int lo, hi;
+    if(!histo || nbins < 2 || !thr || !nonempty(histo, nbins, &lo, &hi)) return FALSE;
+    int p = lo;
+    for(int b = lo + 1; b <= hi; ++b) if(histo[b] > histo[p]) p = b;
+    // line from (p, histo[p]) to zero just after the last non-empty bin of tail
+    int dir = (hi - p >= p - lo) ? 1 : -1, e = (dir > 0) ? hi + 1 : lo - 1;
+    double hp = (double)histo[p], len = (double)abs(e - p), best = -1.;
+    int t = p;
+    for(int b = p + dir; b != e; b += dir){
+        double d = hp * abs(e - b) - len * (double)histo[b]; // distance below the line (not normalized)
+        if(d > best){
+            best = d;
+            t = b;
+        }
+    }
+    *thr = t;
+    return TRUE;
+}
+
+// class borders `B[1]..B[K-1]` (class k is bins [B[k], B[k+1]), B[0] = 0, B[K] = n) maximizing sum of S^2/N
+static void motsu_dp(const double *N, const double *S, int n, int K, int *B){
+    double *f = MALLOC(double, (size_t)K * (n + 1));
+    int *arg = MALLOC(int, (size_t)K * (n + 1));
+    // f[k*(n+1) + j] - best sum for k+1 classes over bins [0, j)
+    for(int j = 1; j <= n; ++j) f[j] = classval(N, S, 0, j);
+    for(int k = 1; k < K; ++k){
+        double *fp = f + (size_t)(k - 1) * (n + 1), *fc = fp + n + 1;
+        int *ac = arg + (size_t)k * (n + 1);
+        for(int j = k + 1; j <= n; ++j){
+            double best = -1.;
+            int bi = k;
+            for(int i = k; i < j; ++i){
+                double v = fp[i] + classval(N, S, i, j);
+                if(v > best){
+                    best = v;
+                    bi = i;
+                }
+            }
+            fc[j] = best;
+            ac[j] = bi;
+        }
+    }
+    B[0] = 0; B[K] = n;
+    for(int k = K - 1; k > 0; --k) B[k] = arg[(size_t)k * (n + 1) + B[k+1]];
+    FREE(f); FREE(arg);
+}
+
+/**
+ * @brief il_histo_multiotsu - multi-level Otsu thresholds
+ * @param histo - histogram (e.g. by il_histogram8/il_histogram16)
+ * @param nbins - its size
+ * @param nclasses - amount of classes (>= 2)
+ * @param thr (o) - nclasses-1 increasing threshold bins: class k is bins (thr[k-1], thr[k]]
+ * @return FALSE if error (e.g. less than `nclasses` non-empty bins)
+ */
+int il_histo_multiotsu(const size_t *histo, int nbins, int nclasses, int *thr){
+    int lo, hi;
+    if(!histo || nclasses < 2 || nbins < nclasses || !thr || !nonempty(histo, nbins, &lo, &hi)) return FALSE;
+    const size_t *h = histo + lo;
+    int n = hi - lo + 1, K = nclasses, nne = 0;
+    for(int b = 0; b < n; ++b) nne += (h[b] != 0);
+    if(nne < K) return FALSE;
+    double *N = MALLOC(double, n + 1), *S = MALLOC(double, n + 1);
+    prefix(h, n, N, S);
+    int *B = MALLOC(int, K + 1);
+    int g = (n + MOTSU_NBINS - 1) / MOTSU_NBINS; // original bins in merged one
+    if(g == 1) motsu_dp(N, S, n, K, B);
+    else{ // merged bin `c` is original bins [c*g, (c+1)*g): borders are the same, so take its prefix sums
+        int nc = (n + g - 1) / g;
+        double *Nc = MALLOC(double, nc + 1), *Sc = MALLOC(double, nc + 1);
+        for(int c = 0; c <= nc; ++c){
+            int j = (c * g < n) ? c * g : n;
+            Nc[c] = N[j]; Sc[c] = S[j];
+        }
+        motsu_dp(Nc, Sc, nc, K, B);
+        FREE(Nc); FREE(Sc);
+        // refine each border by original bins in neighbouring merged bins (others are fixed)
+        for(int k = 1; k < K; ++k) B[k] *= g;
+        B[K] = n;
+        for(int k = 1; k < K; ++k){
+            int i0 = B[k] - g, i1 = B[k] + g;
+            if(i0 <= B[k-1]) i0 = B[k-1] + 1;
+            if(i1 >= B[k+1]) i1 = B[k+1] - 1;
+            double best = -1.;
+            for(int i = i0; i <= i1; ++i){
+                double v = classval(N, S, B[k-1], i) + classval(N, S, i, B[k+1]);
+                if(v > best){
+                    best = v;
+                    B[k] = i;
+                }
+            }
+        }
+    }
+    for(int k = 1; k < K; ++k) thr[k-1] = lo + B[k] - 1;
+    FREE(B); FREE(N); FREE(S);
+    return TRUE;
+}
+
+// histogram for thresholds: one bin per value for U8/U16 (cached), il_Image_histogram() for others
+static int thr_histo(const il_Image *I, il_Histogram *H){
+    switch(I->type){
+        case IMTYPE_U8:
+            *H = (il_Histogram){.nbins = 256, .min = 0., .max = 256., .bins = il_histogram8(I)};
+        break;
+        case IMTYPE_U16:
+            *H = (il_Histogram){.nbins = 65536, .min = 0., .max = 65536., .bins = il_histogram16(I)};
+        break;
+        default:{
+            il_Histogram *Hp = il_Image_histogram(I, 0, 0., 0.);
+            if(!Hp) return FALSE;
+            *H = *Hp;
+            FREE(Hp);
+        }
+    }
+    return (H->bins != NULL);
+}
+
+// level for il_Image2bin() by threshold bin `t`: pixels of bins > t are greater than it
+static double bin2level(const il_Image *I, const il_Histogram *H, int t){
+    double e = H->min + (t + 1.) * (H->max - H->min) / H->nbins; // lower edge of bin t+1
+    if(I->type == IMTYPE_U8 || I->type == IMTYPE_U16 || I->type == IMTYPE_U32) return ceil(e) - 1.;
+    return nextafter(e, -INFINITY);
+}
+
+/**
+ * @brief il_Image_threshold - automatic global threshold by image histogram
+ * @param I - image
+ * @param method - IL_THRESH_OTSU or IL_THRESH_TRIANGLE
+ * @param thr (o) - threshold level for il_Image2bin()
+ * @return FALSE if error
+ */
+int il_Image_threshold(const il_Image *I, il_thresh_t method, double *thr){
+    if(!I || !I->data || I->type >= IMTYPE_AMOUNT || method >= IL_THRESH_AMOUNT || !thr) return FALSE;
+    il_Histogram H;
+    if(!thr_histo(I, &H)){
+        WARNX("il_Image_threshold(): can't calculate histogram");
+        return FALSE;
+    }
+    int t, ret = (method == IL_THRESH_OTSU) ? il_histo_otsu(H.bins, H.nbins, &t) : il_histo_triangle(H.bins, H.nbins, &t);
+    if(ret) *thr = bin2level(I, &H, t);
+    FREE(H.bins);
+    return ret;
+}
+
+/**
+ * @brief il_Image_multithreshold - multi-level Otsu thresholds by image histogram
+ * @param I - image
+ * @param nclasses - amount of classes (>= 2)
+ * @param thr (o) - nclasses-1 increasing threshold levels (class k is pixels in (thr[k-1], thr[k]])
+ * @return FALSE if error
+ */
+int il_Image_multithreshold(const il_Image *I, int nclasses, double *thr){
+    if(!I || !I->data || I->type >= IMTYPE_AMOUNT || nclasses < 2 || !thr) return FALSE;
+    il_Histogram H;
+    if(!thr_histo(I, &H)){
+        WARNX("il_Image_multithreshold(): can't calculate histogram");
+        return FALSE;
+    }
+    int *t = MALLOC(int, nclasses - 1);
+    int ret = il_histo_multiotsu(H.bins, H.nbins, nclasses, t);
+    if(ret) for(int k = 0; k < nclasses - 1; ++k) thr[k] = bin2level(I, &H, t[k]);
+    FREE(t); FREE(H.bins);
+    return ret;
+}
@@ -0,0 +1,161 @@
+/*
+ * This file is part of the improclib project.
+ * Copyright 2023 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// tiled layout for very large images: each tile is contiguous square block of pixels
+
+#include <usefull_macros.h>
+#include <float.h>
+#include <string.h>
+
+#include "improclib.h"
+#include "openmp.h"
+
+/**
+ * @brief il_TiledImage_new - allocate empty (zero-filled) tiled image
+ * @param w, h - image size
+ * @param type - pixel type
+ * @param tilesize - tile side (pixels), multiple of 8 (e.g. 64 or 256)
+ * @return image allocated here or NULL if error
+ */
+il_TiledImage *il_TiledImage_new(int w, int h, il_imtype_t type, int tilesize){
+    if(w < 1 || h < 1 || type >= IMTYPE_AMOUNT) return NULL;
+    if(tilesize < 8 || tilesize % 8){
+        WARNX("il_TiledImage_new(): tile size should be positive multiple of 8");
+        return NULL;
+    }
+    il_TiledImage *T = MALLOC(il_TiledImage, 1);
+    T->width = w;
+    T->height = h;
+    T->type = type;
+    T->pixbytes = il_getpixbytes(type);
+    T->tilesize = tilesize;
+    T->ntx = (w + tilesize - 1) / tilesize;
+    T->nty = (h + tilesize - 1) / tilesize;
+    size_t tb = (size_t)tilesize * tilesize * T->pixbytes;
+    T->tilebytes = (tb + IL_ALIGN - 1) / IL_ALIGN * IL_ALIGN;
+    T->data = il_alloc_rows(T->tilebytes, T->ntx * T->nty);
+    return T;
+}
+
+void il_TiledImage_free(il_TiledImage **T){
+    if(!T || !*T) return;
+    FREE((*T)->data);
+    FREE(*T);
+}
+
+/**
+ * @brief il_TiledImage_tile - tile iterator: make view over tile number `n`
+ *          tiles are numbered row by row: n = ty*ntx + tx, 0 <= n < IL_NTILES(T);
+ *          V->x0, V->y0 are coordinates of tile on the full frame, V->parent is NULL; tile statistics aren't cached
+ * @param T - tiled image
+ * @param n - tile number
+ * @param V (o) - view to fill (its I.pitch is tilesize*pixbytes)
+ * @return FALSE if there's no such tile
+ */
+int il_TiledImage_tile(const il_TiledImage *T, int n, il_ImageView *V){
+    if(!T || !T->data || !V || n < 0 || n >= IL_NTILES(T)) return FALSE;
+    int ts = T->tilesize;
+    int x0 = (n % T->ntx) * ts, y0 = (n / T->ntx) * ts;
+    memset(V, 0, sizeof(il_ImageView));
+    V->x0 = x0; V->y0 = y0;
+    V->I.width = (T->width - x0 < ts) ? T->width - x0 : ts;
+    V->I.height = (T->height - y0 < ts) ? T->height - y0 : ts;
+    V->I.type = T->type;
+    V->I.pixbytes = T->pixbytes;
+    V->I.pitch = (size_t)ts * T->pixbytes;
+    V->I.data = (uint8_t*)T->data + (size_t)n * T->tilebytes;
+    V->I.stat.flags = IL_STAT_NOCACHE; // header could be on stack: never allocate cache in it
+    return TRUE;
+}
+
+/**
+ * @brief il_Image2tiled - convert row-major image into tiled
+ * @param I - input image
+ * @param tilesize - tile side
+ * @return tiled image allocated here or NULL if error
+ */
+il_TiledImage *il_Image2tiled(const il_Image *I, int tilesize){
+    if(!I || !I->data) return NULL;
+    il_TiledImage *T = il_TiledImage_new(I->width, I->height, I->type, tilesize);
+    if(!T) return NULL;
+    int N = IL_NTILES(T);
+    OMP_FOR()
+    for(int n = 0; n < N; ++n){
+        il_ImageView V;
+        il_TiledImage_tile(T, n, &V);
+        size_t rowbytes = (size_t)V.I.width * T->pixbytes, xoff = (size_t)V.x0 * T->pixbytes;
+        for(int y = 0; y < V.I.height; ++y)
+            memcpy(IL_ROW(uint8_t, &V.I, y), IL_ROW(uint8_t, I, V.y0 + y) + xoff, rowbytes);
+    }
+    return T;
+}
+
+/**
+ * @brief il_tiled2Image - convert tiled image into row-major
+ * @param T - tiled image
+ * @return image allocated here or NULL if error
+ */
+il_Image *il_tiled2Image(const il_TiledImage *T){
+    if(!T || !T->data) return NULL;
+    il_Image *I = il_Image_new(T->width, T->height, T->type);
+    if(!I) return NULL;
+    int N = IL_NTILES(T);
+    OMP_FOR()
+    for(int n = 0; n < N; ++n){
+        il_ImageView V;
+        il_TiledImage_tile(T, n, &V);
+        size_t rowbytes = (size_t)V.I.width * T->pixbytes, xoff = (size_t)V.x0 * T->pixbytes;
+        for(int y = 0; y < V.I.height; ++y)
+            memcpy(IL_ROW(uint8_t, I, V.y0 + y) + xoff, IL_ROW(uint8_t, &V.I, y), rowbytes);
+    }
+    return I;
+}
+
+/**
+ * @brief il_TiledImage_minmax - find extremal values of tiled image (tiles are processed in parallel)
+ * @param T - image
+ * @param min, max (o) - extremal values (or NULL)
+ * @return FALSE if error
+ */
+int il_TiledImage_minmax(const il_TiledImage *T, double *min, double *max){
+    if(!T || !T->data) return FALSE;
+    double gmin = DBL_MAX, gmax = -DBL_MAX;
+    int N = IL_NTILES(T);
+#pragma omp parallel
+{
+    double lmin = DBL_MAX, lmax = -DBL_MAX;
+    #pragma omp for nowait
+    for(int n = 0; n < N; ++n){
+        il_ImageView V;
+        il_TiledImage_tile(T, n, &V);
+        il_Stats st; // inner loop is serial: we are already in parallel section
+        if(!il_Image_stats(&V.I, &st) || st.npix == 0) continue; // all pixels of tile are NaN
+        if(st.min < lmin) lmin = st.min;
+        if(st.max > lmax) lmax = st.max;
+    }
+    #pragma omp critical
+    {
+        if(lmin < gmin) gmin = lmin;
+        if(lmax > gmax) gmax = lmax;
+    }
+}
+    if(gmin > gmax) gmin = gmax = 0.; // all pixels are NaN
+    if(min) *min = gmin;
+    if(max) *max = gmax;
+    return TRUE;
+}